@@ -0,0 +1,184 @@
+#include "alloc_profiler.h"
+
+#if defined(MCA2PNG_ALLOC_PROFILE)
+
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <errno.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace {
+
+char const* const kStageNames[kAllocStageCount] = {
+    "other",
+    "chunk load",
+    "render",
+    "merge",
+    "shading",
+    "encode",
+    "zopfli",
+};
+
+struct StageCounters {
+    std::atomic<uint64_t> fAllocs;
+    std::atomic<uint64_t> fFrees;
+    std::atomic<uint64_t> fAllocatedBytes;
+    std::atomic<uint64_t> fFreedBytes;
+};
+
+struct StageSnapshot {
+    uint64_t fAllocs;
+    uint64_t fFrees;
+    uint64_t fAllocatedBytes;
+    uint64_t fFreedBytes;
+};
+
+// malloc の中から使われるので, 動的初期化を伴うオブジェクトは置かない.
+StageCounters sStages[kAllocStageCount];
+StageSnapshot sRegionBegin[kAllocStageCount];
+std::atomic<int64_t> sLiveBytes;
+std::atomic<int64_t> sPeakLiveBytes;
+thread_local AllocStage tStage = AllocStage::Other;
+
+void RecordAlloc(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    size_t const size = malloc_usable_size(ptr);
+    auto& stage = sStages[(int)tStage];
+    stage.fAllocs.fetch_add(1, std::memory_order_relaxed);
+    stage.fAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    int64_t const live = sLiveBytes.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size;
+    int64_t peak = sPeakLiveBytes.load(std::memory_order_relaxed);
+    while (live > peak && !sPeakLiveBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+void RecordFree(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    size_t const size = malloc_usable_size(ptr);
+    auto& stage = sStages[(int)tStage];
+    stage.fFrees.fetch_add(1, std::memory_order_relaxed);
+    stage.fFreedBytes.fetch_add(size, std::memory_order_relaxed);
+    sLiveBytes.fetch_sub((int64_t)size, std::memory_order_relaxed);
+}
+
+} // namespace
+
+#if defined(__GLIBC__)
+
+// glibc では実行ファイル側で定義した malloc 系関数が優先されるので, operator new を含めて
+// C ライブラリ (lodepng, zopfli, zlib) の確保もここを通る.
+extern "C" {
+
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+void __libc_free(void*);
+
+void* malloc(size_t size) {
+    void* ptr = __libc_malloc(size);
+    RecordAlloc(ptr);
+    return ptr;
+}
+
+void* calloc(size_t count, size_t size) {
+    void* ptr = __libc_calloc(count, size);
+    RecordAlloc(ptr);
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+    RecordFree(ptr);
+    void* result = __libc_realloc(ptr, size);
+    if (result) {
+        RecordAlloc(result);
+    } else if (ptr && size > 0) {
+        RecordAlloc(ptr);
+    }
+    return result;
+}
+
+void* memalign(size_t alignment, size_t size) {
+    void* ptr = __libc_memalign(alignment, size);
+    RecordAlloc(ptr);
+    return ptr;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+    void* ptr = memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+void free(void* ptr) {
+    RecordFree(ptr);
+    __libc_free(ptr);
+}
+
+}
+
+#endif
+
+void AllocProfiler::BeginRegion() {
+    for (int i = 0; i < kAllocStageCount; i++) {
+        auto const& stage = sStages[i];
+        sRegionBegin[i] = {
+            .fAllocs = stage.fAllocs.load(),
+            .fFrees = stage.fFrees.load(),
+            .fAllocatedBytes = stage.fAllocatedBytes.load(),
+            .fFreedBytes = stage.fFreedBytes.load(),
+        };
+    }
+    sPeakLiveBytes = sLiveBytes.load();
+}
+
+void AllocProfiler::Report(std::ostream& out, int regionX, int regionZ) {
+#if !defined(__GLIBC__)
+    out << "allocation profiling requires glibc" << std::endl;
+#else
+    out << "allocations for r." << regionX << "." << regionZ << ":" << std::endl;
+    for (int i = 0; i < kAllocStageCount; i++) {
+        auto const& stage = sStages[i];
+        auto const& begin = sRegionBegin[i];
+        uint64_t const allocs = stage.fAllocs.load() - begin.fAllocs;
+        uint64_t const frees = stage.fFrees.load() - begin.fFrees;
+        if (allocs == 0 && frees == 0) {
+            continue;
+        }
+        out << std::setw(12) << kStageNames[i]
+            << "  allocs=" << allocs
+            << " frees=" << frees
+            << " allocated=" << (stage.fAllocatedBytes.load() - begin.fAllocatedBytes)
+            << " freed=" << (stage.fFreedBytes.load() - begin.fFreedBytes)
+            << std::endl;
+    }
+    out << std::setw(12) << "peak live" << "  " << sPeakLiveBytes.load() << " bytes" << std::endl;
+#endif
+}
+
+AllocScope::AllocScope(AllocStage stage)
+    : fPrevious(tStage)
+{
+    tStage = stage;
+}
+
+AllocScope::~AllocScope() {
+    tStage = fPrevious;
+}
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <ostream>
+
+enum class AllocStage : int {
+    Other = 0,
+    ChunkLoad,
+    Render,
+    Merge,
+    Shading,
+    Encode,
+    Zopfli,
+};
+
+int const kAllocStageCount = 7;
+
+// MCA2PNG_ALLOC_PROFILE を定義してビルドした場合のみ, malloc/free を横取りして
+// 現在のスレッドのステージ毎に確保・解放の回数とバイト数を数える.
+#if defined(MCA2PNG_ALLOC_PROFILE)
+
+// カウンタはプロセス全体で 1 組なので, BeginRegion から Report までの間に他のリージョンを
+// 描いてはいけない. main では --max-regions を 1 にしている.
+class AllocProfiler {
+    AllocProfiler() = delete;
+
+public:
+    static void BeginRegion();
+    static void Report(std::ostream& out, int regionX, int regionZ);
+};
+
+class AllocScope {
+public:
+    explicit AllocScope(AllocStage stage);
+    ~AllocScope();
+
+    AllocScope(AllocScope const&) = delete;
+    AllocScope& operator=(AllocScope const&) = delete;
+
+private:
+    AllocStage const fPrevious;
+};
+
+#else
+
+class AllocProfiler {
+    AllocProfiler() = delete;
+
+public:
+    static void BeginRegion() {}
+    static void Report(std::ostream&, int, int) {}
+};
+
+class AllocScope {
+public:
+    explicit AllocScope(AllocStage) {}
+
+    AllocScope(AllocScope const&) = delete;
+    AllocScope& operator=(AllocScope const&) = delete;
+};
+
+#endif
@@ -1,52 +1,55 @@
 #include "block_color.h"
 
-static Color const kColorPotter(135, 75, 58);
-static Color const kColorPlanksBirch(244, 230, 161);
-static Color const kColorPlanksDarkOak(101, 75, 50);
-static Color const kColorPlanksOak(127, 85, 48);
-static Color const kColorPlanksJungle(149, 108, 76);
-static Color const kColorPlanksSpruce(122, 89, 51);
-static Color const kColorPlanksCrimson(125, 57, 85);
-static Color const kColorPlanksWarped(56, 129, 128);
-static Color const kColorPlanksManvrove(137, 76, 57);
-static Color const kColorBricks(175, 98, 76);
-static Color const kColorAnvil(73, 73, 73);
-static Color const kColorDeadCoral(115, 105, 102);
-static Color const kColorRail(154, 154, 154);
-static Color const kColorStoneDiorite(252, 249, 242);
-static Color const kColorStoneGranite(149, 108, 76);
-static Color const kColorStoneAndesite(165, 168, 151);
-static Color const kColorStone(111, 111, 111);
-static Color const kColorStoneBlack(48, 43, 53);
-static Color const kColorStonePolishedBlack(59, 56, 70);
-static Color const kColorNetherBricks(33, 17, 20);
-static Color const kColorFurnace(131, 131, 131);
-static Color const kColorEndStoneBricks(233, 248, 173);
-static Color const kColorPolishedBlackStoneBricks(32, 28, 23);
-static Color const kColorRedSandstone(184, 102, 33);
-static Color const kColorSand(201,192,154);
-static Color const kColorDragonHead(22, 22, 22);
-static Color const kColorQuartz(235, 227, 219);
-static Color const kColorMossyStone(115, 131, 82);
-static Color const kColorPistonHead(186, 150, 97);
-static Color const kColorPurPur(170, 122, 170);
-static Color const kColorPrismarine(75, 125, 151);
-static Color const kColorRedNetherBricks(89, 0, 0);
-static Color const kColorCreaperHead(96, 202, 77);
-static Color const kColorOakLog(141, 118, 71);
-static Color const kColorPlayerHead(46, 31, 14);
-static Color const kColorSkeltonSkull(186, 186, 186);
-static Color const kColorSpruceLog(141, 118, 71);
-static Color const kColorChest(141, 118, 71);
-static Color const kColorWitherSkeltonSkull(31, 31, 31);
-static Color const kColorZombieHead(61, 104, 45);
-static Color const kColorDeepslate(104, 104, 104);
-static Color const kColorCopper(224, 128, 107);
-static Color const kColorExposedCopper(150, 138, 104);
-static Color const kColorWeatheredCopper(99, 158, 118);
-static Color const kColorOxidizedCopper(75, 146, 130);
+#include <array>
+#include <utility>
 
-std::unordered_map<mcfile::blocks::BlockId, Color> const blockToColor {
+static constexpr Color kColorPotter(135, 75, 58);
+static constexpr Color kColorPlanksBirch(244, 230, 161);
+static constexpr Color kColorPlanksDarkOak(101, 75, 50);
+static constexpr Color kColorPlanksOak(127, 85, 48);
+static constexpr Color kColorPlanksJungle(149, 108, 76);
+static constexpr Color kColorPlanksSpruce(122, 89, 51);
+static constexpr Color kColorPlanksCrimson(125, 57, 85);
+static constexpr Color kColorPlanksWarped(56, 129, 128);
+static constexpr Color kColorPlanksManvrove(137, 76, 57);
+static constexpr Color kColorBricks(175, 98, 76);
+static constexpr Color kColorAnvil(73, 73, 73);
+static constexpr Color kColorDeadCoral(115, 105, 102);
+static constexpr Color kColorRail(154, 154, 154);
+static constexpr Color kColorStoneDiorite(252, 249, 242);
+static constexpr Color kColorStoneGranite(149, 108, 76);
+static constexpr Color kColorStoneAndesite(165, 168, 151);
+static constexpr Color kColorStone(111, 111, 111);
+static constexpr Color kColorStoneBlack(48, 43, 53);
+static constexpr Color kColorStonePolishedBlack(59, 56, 70);
+static constexpr Color kColorNetherBricks(33, 17, 20);
+static constexpr Color kColorFurnace(131, 131, 131);
+static constexpr Color kColorEndStoneBricks(233, 248, 173);
+static constexpr Color kColorPolishedBlackStoneBricks(32, 28, 23);
+static constexpr Color kColorRedSandstone(184, 102, 33);
+static constexpr Color kColorSand(201,192,154);
+static constexpr Color kColorDragonHead(22, 22, 22);
+static constexpr Color kColorQuartz(235, 227, 219);
+static constexpr Color kColorMossyStone(115, 131, 82);
+static constexpr Color kColorPistonHead(186, 150, 97);
+static constexpr Color kColorPurPur(170, 122, 170);
+static constexpr Color kColorPrismarine(75, 125, 151);
+static constexpr Color kColorRedNetherBricks(89, 0, 0);
+static constexpr Color kColorCreaperHead(96, 202, 77);
+static constexpr Color kColorOakLog(141, 118, 71);
+static constexpr Color kColorPlayerHead(46, 31, 14);
+static constexpr Color kColorSkeltonSkull(186, 186, 186);
+static constexpr Color kColorSpruceLog(141, 118, 71);
+static constexpr Color kColorChest(141, 118, 71);
+static constexpr Color kColorWitherSkeltonSkull(31, 31, 31);
+static constexpr Color kColorZombieHead(61, 104, 45);
+static constexpr Color kColorDeepslate(104, 104, 104);
+static constexpr Color kColorCopper(224, 128, 107);
+static constexpr Color kColorExposedCopper(150, 138, 104);
+static constexpr Color kColorWeatheredCopper(99, 158, 118);
+static constexpr Color kColorOxidizedCopper(75, 146, 130);
+
+static constexpr std::pair<mcfile::blocks::BlockId, Color> kBlockColors[] = {
     {mcfile::blocks::minecraft::stone, Color(111, 111, 111)},
     {mcfile::blocks::minecraft::granite, kColorStoneGranite},
     {mcfile::blocks::minecraft::diorite, kColorStoneDiorite},
@@ -884,28 +887,7 @@ std::unordered_map<mcfile::blocks::BlockId, Color> const blockToColor {
     {mcfile::blocks::minecraft::mud, Color(57, 55, 60)},
 };
 
-std::optional<Color> BlockColor(mcfile::je::Block const& block) {
-    auto blockId = mcfile::blocks::FromName(block.fName);
-    if (blockId == mcfile::blocks::unknown) {
-        return std::nullopt;
-    }
-    if (blockId == mcfile::blocks::minecraft::campfire) {
-        auto lit = block.fProperties.find("lit");
-        if (lit != block.fProperties.end() && lit->second == "true") {
-            return Color(199, 107, 3);
-        } else {
-            return kColorPlanksOak;
-        }
-    }
-    auto it = blockToColor.find(blockId);
-    if (it == blockToColor.end()) {
-        return std::nullopt;
-    } else {
-        return it->second;
-    }
-}
-
-static std::unordered_set<mcfile::blocks::BlockId> const sPlantBlocks = {
+static constexpr mcfile::blocks::BlockId kPlantBlocks[] = {
     mcfile::blocks::minecraft::beetroots,
     mcfile::blocks::minecraft::carrots,
     mcfile::blocks::minecraft::potatoes,
@@ -921,11 +903,7 @@ static std::unordered_set<mcfile::blocks::BlockId> const sPlantBlocks = {
     mcfile::blocks::minecraft::small_dripleaf,
 };
 
-bool IsPlantBlock(mcfile::blocks::BlockId id) {
-    return sPlantBlocks.find(id) != sPlantBlocks.end();
-}
-
-static std::unordered_set<mcfile::blocks::BlockId> const sTransparentBlocks = {
+static constexpr mcfile::blocks::BlockId kTransparentBlocks[] = {
     mcfile::blocks::minecraft::air,
     mcfile::blocks::minecraft::cave_air,
     mcfile::blocks::minecraft::vine, // Colour(56, 95, 31)}, //
@@ -1033,6 +1011,111 @@ static std::unordered_set<mcfile::blocks::BlockId> const sTransparentBlocks = {
     mcfile::blocks::minecraft::mangrove_propagule,
 };
 
+static constexpr mcfile::blocks::BlockId kWaterBlocks[] = {
+    mcfile::blocks::minecraft::water,
+    mcfile::blocks::minecraft::bubble_column,
+    mcfile::blocks::minecraft::kelp,
+    mcfile::blocks::minecraft::seagrass,
+    mcfile::blocks::minecraft::tall_seagrass,
+};
+
+namespace {
+
+struct BlockInfo {
+    Color fColor;
+    uint8_t fFlags;
+};
+
+uint8_t const kHasColor = 1;
+uint8_t const kPlant = 2;
+uint8_t const kTransparent = 4;
+uint8_t const kWater = 8;
+
+// BlockId で直接引けるように, 色とフラグを 1 つの表にまとめる.
+constexpr auto kBlockInfo = [] {
+    std::array<BlockInfo, mcfile::blocks::minecraft::minecraft_max_block_id> table{};
+    for (auto const& [id, color] : kBlockColors) {
+        // unordered_map の初期化子と同じく, 重複したキーは最初のものを採用する.
+        if (!(table[id].fFlags & kHasColor)) {
+            table[id].fColor = color;
+            table[id].fFlags |= kHasColor;
+        }
+    }
+    for (auto id : kPlantBlocks) {
+        table[id].fFlags |= kPlant;
+    }
+    for (auto id : kTransparentBlocks) {
+        table[id].fFlags |= kTransparent;
+    }
+    for (auto id : kWaterBlocks) {
+        table[id].fFlags |= kWater;
+    }
+    return table;
+}();
+
+uint8_t Flags(mcfile::blocks::BlockId id) {
+    return id < kBlockInfo.size() ? kBlockInfo[id].fFlags : 0;
+}
+
+} // namespace
+
+std::optional<Color> BlockColor(mcfile::je::Block const& block) {
+    auto blockId = block.fId;
+    if (blockId == mcfile::blocks::unknown) {
+        return std::nullopt;
+    }
+    if (blockId == mcfile::blocks::minecraft::campfire) {
+        auto lit = block.fProperties.find("lit");
+        if (lit != block.fProperties.end() && lit->second == "true") {
+            return Color(199, 107, 3);
+        } else {
+            return kColorPlanksOak;
+        }
+    }
+    if (!(Flags(blockId) & kHasColor)) {
+        return std::nullopt;
+    }
+    return kBlockInfo[blockId].fColor;
+}
+
+bool IsPlantBlock(mcfile::blocks::BlockId id) {
+    return Flags(id) & kPlant;
+}
+
 bool IsTransparentBlock(mcfile::blocks::BlockId id) {
-    return sTransparentBlocks.find(id) != sTransparentBlocks.end();
+    return Flags(id) & kTransparent;
+}
+
+static bool IsSlab(mcfile::je::Block const& block) {
+    return block.fName.ends_with("_slab");
+}
+
+static bool IsStairs(mcfile::je::Block const& block) {
+    return block.fName.ends_with("_stairs");
+}
+
+static bool IsTrapdoor(mcfile::je::Block const& block) {
+    return block.fName.ends_with("_trapdoor");
+}
+
+bool IsWaterLikeBlock(mcfile::je::Block const& block) {
+    if (Flags(block.fId) & kWater) {
+        return true;
+    }
+
+    if (block.property("waterlogged") != "true") {
+        return false;
+    }
+
+    if (IsSlab(block) && block.property("type") == "top") {
+        return false;
+    } else if (IsStairs(block) && block.property("half") == "top") {
+        return false;
+    } else if (block.fName == "scaffolding") {
+        return false;
+    } else if (IsTrapdoor(block) && block.property("open") == "close") {
+        return false;
+    }
+
+    return true;
 }
@@ -6,3 +6,6 @@
 std::optional<Color> BlockColor(mcfile::je::Block const& block);
 bool IsPlantBlock(mcfile::blocks::BlockId);
 bool IsTransparentBlock(mcfile::blocks::BlockId);
+// 水, 泡の柱, 昆布, 海草と, 水浸し (waterlogged) のブロック. 状態も調べるので, 走査の中で
+// 何度も引く場合はパレットの要素毎に一度だけ求めておくこと.
+bool IsWaterLikeBlock(mcfile::je::Block const& block);
@@ -0,0 +1,230 @@
+#include "block_states.h"
+
+#include "block_color.h"
+
+#include <algorithm>
+#include <map>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MCA2PNG_UNPACK_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace mcfile;
+
+shared_ptr<je::Block const> const ChunkBlocks::sNoBlock;
+
+static int BitsPerEntry(size_t paletteSize) {
+    int bits = 4;
+    while (((size_t)1 << bits) < paletteSize) {
+        bits++;
+    }
+    return bits;
+}
+
+static void UnpackScalar(int64_t const* data, int bits, int begin, uint16_t* out) {
+    int const perLong = 64 / bits;
+    uint64_t const mask = ((uint64_t)1 << bits) - 1;
+    int i = begin;
+    for (int l = begin / perLong; i < 4096; l++) {
+        uint64_t v = (uint64_t)data[l] >> ((i % perLong) * bits);
+        for (int k = i % perLong; k < perLong && i < 4096; k++, i++) {
+            out[i] = (uint16_t)(v & mask);
+            v >>= bits;
+        }
+    }
+}
+
+#if defined(MCA2PNG_UNPACK_AVX2)
+
+// long 1 つを 4 レーンに複製して, レーン毎に別々のエントリ分だけ右シフトする.
+// packus を 2 回通した後にエントリが順番に並ぶよう, レーンへの割り当てを入れ替えてある.
+template<int Bits>
+__attribute__((target("avx2")))
+static __m256i Extract(__m256i v, int e0, int e1, int e2, int e3) {
+    __m256i const shift = _mm256_setr_epi64x(e0 * Bits, e1 * Bits, e2 * Bits, e3 * Bits);
+    __m256i const mask = _mm256_set1_epi64x(((int64_t)1 << Bits) - 1);
+    // 64 以上のシフトは 0 になる
+    return _mm256_and_si256(_mm256_srlv_epi64(v, shift), mask);
+}
+
+template<int Bits>
+__attribute__((target("avx2")))
+static void UnpackAvx2(int64_t const* data, uint16_t* out) {
+    int const perLong = 64 / Bits;
+    int pos = 0;
+    int i = 0;
+    if constexpr (perLong > 8) {
+        // long 1 つから 16 エントリ分を取り出して書き込み, perLong だけ進める.
+        // 余分に書いた分は次の long で上書きされる.
+        for (; pos + 16 <= 4096; pos += perLong, i++) {
+            __m256i const v = _mm256_set1_epi64x(data[i]);
+            __m256i const v0 = Extract<Bits>(v, 0, 1, 8, 9);
+            __m256i const v1 = Extract<Bits>(v, 2, 3, 10, 11);
+            __m256i const v2 = Extract<Bits>(v, 4, 5, 12, 13);
+            __m256i const v3 = Extract<Bits>(v, 6, 7, 14, 15);
+            __m256i const p = _mm256_packus_epi32(_mm256_packus_epi32(v0, v1), _mm256_packus_epi32(v2, v3));
+            _mm256_storeu_si256((__m256i*)(out + pos), p);
+        }
+    } else {
+        for (; pos + 8 <= 4096; pos += perLong, i++) {
+            __m256i const v = _mm256_set1_epi64x(data[i]);
+            __m256i const v0 = Extract<Bits>(v, 0, 1, 4, 5);
+            __m256i const v1 = Extract<Bits>(v, 2, 3, 6, 7);
+            __m256i const p01 = _mm256_packus_epi32(v0, v1);
+            __m256i const p = _mm256_permute4x64_epi64(_mm256_packus_epi32(p01, p01), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i*)(out + pos), _mm256_castsi256_si128(p));
+        }
+    }
+    UnpackScalar(data, Bits, pos, out);
+}
+
+static bool UnpackVectorized(int64_t const* data, int bits, uint16_t* out) {
+    static bool const sAvx2 = __builtin_cpu_supports("avx2");
+    if (!sAvx2) {
+        return false;
+    }
+    switch (bits) {
+        case 4: UnpackAvx2<4>(data, out); return true;
+        case 5: UnpackAvx2<5>(data, out); return true;
+        case 6: UnpackAvx2<6>(data, out); return true;
+        case 7: UnpackAvx2<7>(data, out); return true;
+        case 8: UnpackAvx2<8>(data, out); return true;
+        case 9: UnpackAvx2<9>(data, out); return true;
+        case 10: UnpackAvx2<10>(data, out); return true;
+        case 11: UnpackAvx2<11>(data, out); return true;
+        case 12: UnpackAvx2<12>(data, out); return true;
+        default: return false;
+    }
+}
+
+#else
+
+static bool UnpackVectorized(int64_t const*, int, uint16_t*) {
+    return false;
+}
+
+#endif
+
+bool UnpackBlockStates(vector<int64_t> const& data, size_t paletteSize, uint16_t* out) {
+    if (paletteSize == 0 || 4096 < paletteSize) {
+        return false;
+    }
+    if (paletteSize == 1 && data.empty()) {
+        fill_n(out, 4096, 0);
+        return true;
+    }
+    int const bits = BitsPerEntry(paletteSize);
+    int const perLong = 64 / bits;
+    if (data.size() != (size_t)(4096 + perLong - 1) / perLong) {
+        return false;
+    }
+    if (!UnpackVectorized(data.data(), bits, out)) {
+        UnpackScalar(data.data(), bits, 0, out);
+    }
+    return true;
+}
+
+// biomes (4x4x4 の 64 要素) を展開する. 壊れている場合は false.
+static bool UnpackBiomes(nbt::CompoundTag const& biomes, vector<string>& names, array<uint8_t, 64>& out) {
+    auto palette = biomes.listTag("palette");
+    if (!palette || palette->fValue.empty() || 64 < palette->fValue.size()) {
+        return false;
+    }
+    for (auto const& entry : palette->fValue) {
+        auto name = dynamic_pointer_cast<nbt::StringTag>(entry);
+        if (!name) {
+            return false;
+        }
+        names.push_back(name->fValue);
+    }
+    if (names.size() == 1) {
+        out.fill(0);
+        return true;
+    }
+    auto data = biomes.longArrayTag("data");
+    int bits = 1;
+    while (((size_t)1 << bits) < names.size()) {
+        bits++;
+    }
+    int const perLong = 64 / bits;
+    if (!data || data->value().size() != (size_t)(64 + perLong - 1) / perLong) {
+        return false;
+    }
+    uint64_t const mask = ((uint64_t)1 << bits) - 1;
+    for (int i = 0; i < 64; i++) {
+        uint64_t const v = ((uint64_t)data->value()[i / perLong] >> ((i % perLong) * bits)) & mask;
+        if (names.size() <= v) {
+            return false;
+        }
+        out[i] = (uint8_t)v;
+    }
+    return true;
+}
+
+shared_ptr<ChunkBlocks> ChunkBlocks::Make(int chunkX, int chunkZ, nbt::CompoundTag const& root) {
+    auto sections = root.listTag("sections");
+    if (!sections) {
+        return nullptr;
+    }
+    map<int, unique_ptr<Section>> loaded;
+    for (auto const& item : sections->fValue) {
+        auto section = dynamic_pointer_cast<nbt::CompoundTag>(item);
+        if (!section) {
+            return nullptr;
+        }
+        auto y = section->byte("Y");
+        if (!y) {
+            return nullptr;
+        }
+        // 光源の情報だけを持つセクション (ワールドの上下端の外側など) には block_states が無い.
+        auto states = section->compoundTag("block_states");
+        if (!states) {
+            continue;
+        }
+        auto palette = states->listTag("palette");
+        if (!palette || palette->fValue.empty()) {
+            continue;
+        }
+        auto s = make_unique<Section>();
+        s->fPalette.reserve(palette->fValue.size());
+        s->fWaterLike.reserve(palette->fValue.size());
+        for (auto const& entry : palette->fValue) {
+            auto tag = dynamic_pointer_cast<nbt::CompoundTag>(entry);
+            if (!tag) {
+                return nullptr;
+            }
+            s->fPalette.push_back(je::Block::FromCompound(*tag));
+            s->fWaterLike.push_back(s->fPalette.back() && IsWaterLikeBlock(*s->fPalette.back()) ? 1 : 0);
+        }
+        static vector<int64_t> const kEmpty;
+        auto data = states->longArrayTag("data");
+        if (!UnpackBlockStates(data ? data->value() : kEmpty, s->fPalette.size(), s->fIndices.data())) {
+            return nullptr;
+        }
+        // 壊れたデータでパレットの外を指さないように確認しておく.
+        uint16_t const maxIndex = *max_element(s->fIndices.begin(), s->fIndices.end());
+        if (s->fPalette.size() <= maxIndex) {
+            return nullptr;
+        }
+        // バイオームは地図の色には使わないので, 壊れていても無いものとして続ける.
+        if (auto biomes = section->compoundTag("biomes"); biomes && !UnpackBiomes(*biomes, s->fBiomes, s->fBiomeIndices)) {
+            s->fBiomes.clear();
+        }
+        loaded[*y] = move(s);
+    }
+
+    auto blocks = make_shared<ChunkBlocks>();
+    blocks->fChunkX = chunkX;
+    blocks->fChunkZ = chunkZ;
+    if (loaded.empty()) {
+        return blocks;
+    }
+    blocks->fMinSectionY = loaded.begin()->first;
+    blocks->fSections.resize(loaded.rbegin()->first - loaded.begin()->first + 1);
+    for (auto& it : loaded) {
+        blocks->fSections[it.first - blocks->fMinSectionY] = move(it.second);
+    }
+    return blocks;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <minecraft-file.hpp>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// block_states の data (エントリが long をまたがない 1.16 以降の形式) を, セクション 1 つ分
+// 4096 個のパレット番号に展開する. 要素数とパレットの大きさが合わない場合は false.
+bool UnpackBlockStates(std::vector<int64_t> const& data, size_t paletteSize, uint16_t* out);
+
+// 1.18 以降の形式のチャンクを NBT から直接読み込んだもの. ブロックはセクション毎に
+// パレット番号の平坦な配列として持つので, 列の走査ではそれを引くだけで済む.
+class ChunkBlocks {
+public:
+    // 対応していない形式の場合は nullptr を返す.
+    static std::shared_ptr<ChunkBlocks> Make(int chunkX, int chunkZ, mcfile::nbt::CompoundTag const& root);
+
+    int minBlockX() const { return fChunkX * 16; }
+    int maxBlockX() const { return fChunkX * 16 + 15; }
+    int minBlockY() const { return fMinSectionY * 16; }
+    int maxBlockY() const { return (fMinSectionY + (int)fSections.size()) * 16 - 1; }
+    int minBlockZ() const { return fChunkZ * 16; }
+    int maxBlockZ() const { return fChunkZ * 16 + 15; }
+
+    std::shared_ptr<mcfile::je::Block const> const& blockAt(int x, int y, int z) const {
+        Section const* section = sectionAt(y);
+        if (!section) {
+            return sNoBlock;
+        }
+        return section->fPalette[section->fIndices[Index(x - minBlockX(), y & 15, z - minBlockZ())]];
+    }
+
+    // blockAt と同じだが, 水に満たされているか (IsWaterLikeBlock) も返す. 判定はパレットの要素毎に済ませてある.
+    mcfile::je::Block const* blockAt(int x, int y, int z, bool& waterLike) const {
+        Section const* section = sectionAt(y);
+        if (!section) {
+            waterLike = false;
+            return nullptr;
+        }
+        uint16_t const i = section->fIndices[Index(x - minBlockX(), y & 15, z - minBlockZ())];
+        waterLike = section->fWaterLike[i];
+        return section->fPalette[i].get();
+    }
+
+    mcfile::blocks::BlockId blockIdAt(int x, int y, int z) const {
+        auto const& block = blockAt(x, y, z);
+        return block ? block->fId : mcfile::blocks::unknown;
+    }
+
+    // バイオームの名前 ("minecraft:plains" など). バイオームは 4x4x4 ブロック単位. 無ければ nullptr.
+    std::string const* biomeAt(int x, int y, int z) const {
+        Section const* section = sectionAt(y);
+        if (!section || section->fBiomes.empty()) {
+            return nullptr;
+        }
+        int const i = (((y & 15) >> 2) * 4 + ((z - minBlockZ()) >> 2)) * 4 + ((x - minBlockX()) >> 2);
+        return &section->fBiomes[section->fBiomeIndices[i]];
+    }
+
+private:
+    struct Section {
+        std::vector<std::shared_ptr<mcfile::je::Block const>> fPalette;
+        // fPalette と同じ並びの IsWaterLikeBlock の結果
+        std::vector<uint8_t> fWaterLike;
+        std::array<uint16_t, 4096> fIndices;
+        // 空ならバイオームの情報が無い
+        std::vector<std::string> fBiomes;
+        std::array<uint8_t, 64> fBiomeIndices;
+    };
+
+    static int Index(int localX, int localY, int localZ) {
+        return (localY * 16 + localZ) * 16 + localX;
+    }
+
+    Section const* sectionAt(int y) const {
+        int const i = (y >> 4) - fMinSectionY;
+        if (i < 0 || (int)fSections.size() <= i) {
+            return nullptr;
+        }
+        return fSections[i].get();
+    }
+
+private:
+    static std::shared_ptr<mcfile::je::Block const> const sNoBlock;
+
+    int fChunkX = 0;
+    int fChunkZ = 0;
+    int fMinSectionY = 0;
+    // 欠けているセクションは nullptr
+    std::vector<std::unique_ptr<Section>> fSections;
+};
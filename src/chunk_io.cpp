@@ -0,0 +1,473 @@
+#include "chunk_io.h"
+
+#include "progress.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+
+#if defined(MCA2PNG_HAVE_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+struct PendingRead {
+    int fd;
+    size_t offset;
+    ChunkBuffer buffer;
+};
+
+void ReportChunkError(Progress* progress, int chunkX, int chunkZ, char const* what, int error) {
+    if (!progress) {
+        return;
+    }
+    char message[128];
+    snprintf(message, sizeof(message), "%s c.%d.%d.nbt.z: %s", what, chunkX, chunkZ, strerror(error));
+    progress->error(chunkX >> 5, chunkZ >> 5, "read", message);
+}
+
+// ファイルが無い (ENOENT) のは索引の作成後に消えただけなので報告しない.
+int OpenChunk(int directory, ChunkRequest const& request, PendingRead& read, BufferPool& pool, Progress* progress) {
+    char name[64];
+    snprintf(name, sizeof(name), "c.%d.%d.nbt.z", request.chunkX, request.chunkZ);
+    int const fd = openat(directory, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            ReportChunkError(progress, request.chunkX, request.chunkZ, "cannot open", errno);
+        }
+        return -1;
+    }
+    // 索引を作った後にファイルが書き換えられて大きくなっていることがあるので, 大きさは開いた fd で調べる.
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int const error = errno;
+        close(fd);
+        ReportChunkError(progress, request.chunkX, request.chunkZ, "cannot stat", error);
+        return -1;
+    }
+    size_t const size = (size_t)st.st_size;
+    read.fd = fd;
+    read.offset = 0;
+    read.buffer.chunkX = request.chunkX;
+    read.buffer.chunkZ = request.chunkZ;
+    read.buffer.data = pool.acquire(size);
+    return fd;
+}
+
+} // namespace
+
+class ChunkReadBackend {
+public:
+    virtual ~ChunkReadBackend() {}
+    virtual char const* name() const = 0;
+    virtual void read(int directory, vector<ChunkRequest> const& requests, BufferPool& pool, Progress* progress, vector<ChunkBuffer>& out) = 0;
+};
+
+namespace {
+
+class PreadBackend : public ChunkReadBackend {
+public:
+    char const* name() const override {
+        return "pread";
+    }
+
+    void read(int directory, vector<ChunkRequest> const& requests, BufferPool& pool, Progress* progress, vector<ChunkBuffer>& out) override {
+        for (auto const& request : requests) {
+            PendingRead r;
+            if (OpenChunk(directory, request, r, pool, progress) < 0) {
+                continue;
+            }
+            auto& data = r.buffer.data;
+            bool failed = false;
+            while (r.offset < data.size()) {
+                ssize_t const n = pread(r.fd, data.data() + r.offset, data.size() - r.offset, (off_t)r.offset);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0) {
+                    ReportChunkError(progress, request.chunkX, request.chunkZ, "cannot read", errno);
+                    failed = true;
+                    break;
+                }
+                if (n == 0) {
+                    break;
+                }
+                r.offset += (size_t)n;
+            }
+            close(r.fd);
+            // 途中までしか読めなかったものはデコードできないので返さない.
+            if (failed) {
+                pool.release(std::move(data));
+                continue;
+            }
+            data.resize(r.offset);
+            out.push_back(std::move(r.buffer));
+        }
+    }
+};
+
+#if defined(MCA2PNG_HAVE_IO_URING)
+
+class IoUringBackend : public ChunkReadBackend {
+public:
+    static unique_ptr<IoUringBackend> Make(unsigned entries) {
+        unique_ptr<IoUringBackend> backend(new IoUringBackend());
+        if (!backend->setup(entries)) {
+            return nullptr;
+        }
+        return backend;
+    }
+
+    ~IoUringBackend() override {
+        if (fSqes) {
+            munmap(fSqes, fSqesSize);
+        }
+        if (fCqRing && fCqRing != fSqRing) {
+            munmap(fCqRing, fCqRingSize);
+        }
+        if (fSqRing) {
+            munmap(fSqRing, fSqRingSize);
+        }
+        if (fFd >= 0) {
+            close(fFd);
+        }
+    }
+
+    char const* name() const override {
+        return "io_uring";
+    }
+
+    void read(int directory, vector<ChunkRequest> const& requests, BufferPool& pool, Progress* progress, vector<ChunkBuffer>& out) override {
+        // ファイルを開く処理は同期的に行い, 読み込みだけを submit する.
+        // 1 リージョン分 (1000 を超える) を一度に開くと RLIMIT_NOFILE に当たるので,
+        // ring の深さ分の枠に開いては submit し, 読み終えたものから閉じて枠を空ける.
+        vector<PendingRead> reads(fEntries);
+        vector<iovec> iovs(fEntries);
+        vector<size_t> freeSlots;
+        for (size_t i = fEntries; i > 0; i--) {
+            freeSlots.push_back(i - 1);
+        }
+        auto finish = [&](size_t i) {
+            auto& r = reads[i];
+            close(r.fd);
+            r.buffer.data.resize(r.offset);
+            out.push_back(std::move(r.buffer));
+            freeSlots.push_back(i);
+        };
+        // 読み込みに失敗したもの. 途中までのデータは返さない.
+        auto discard = [&](size_t i) {
+            auto& r = reads[i];
+            close(r.fd);
+            pool.release(std::move(r.buffer.data));
+            freeSlots.push_back(i);
+        };
+
+        size_t next = 0;
+        size_t inFlight = 0;
+        deque<size_t> retry;
+        while (true) {
+            unsigned queued = 0;
+            while (!retry.empty() || (next < requests.size() && !freeSlots.empty())) {
+                size_t i;
+                if (!retry.empty()) {
+                    i = retry.front();
+                    retry.pop_front();
+                } else {
+                    i = freeSlots.back();
+                    if (OpenChunk(directory, requests[next++], reads[i], pool, progress) < 0) {
+                        continue;
+                    }
+                    freeSlots.pop_back();
+                }
+                auto& r = reads[i];
+                if (r.offset >= r.buffer.data.size()) {
+                    finish(i);
+                    continue;
+                }
+                iovs[i].iov_base = r.buffer.data.data() + r.offset;
+                iovs[i].iov_len = r.buffer.data.size() - r.offset;
+                push(r.fd, &iovs[i], r.offset, i);
+                queued++;
+                inFlight++;
+            }
+            if (inFlight == 0) {
+                break;
+            }
+            if (!enter(queued, 1)) {
+                int const error = errno;
+                if (progress && !requests.empty()) {
+                    char message[128];
+                    snprintf(message, sizeof(message), "io_uring_enter: %s", strerror(error));
+                    progress->error(requests.front().chunkX >> 5, requests.front().chunkZ >> 5, "read", message);
+                }
+                break;
+            }
+            reap([&](size_t i, int res) {
+                inFlight--;
+                auto& r = reads[i];
+                if (res == -EINTR || res == -EAGAIN) {
+                    retry.push_back(i);
+                    return;
+                }
+                if (res < 0) {
+                    ReportChunkError(progress, r.buffer.chunkX, r.buffer.chunkZ, "cannot read", -res);
+                    discard(i);
+                    return;
+                }
+                if (res == 0) {
+                    // インデックス作成後にファイルが短くなった.
+                    finish(i);
+                    return;
+                }
+                r.offset += (size_t)res;
+                if (r.offset < r.buffer.data.size()) {
+                    retry.push_back(i);
+                } else {
+                    finish(i);
+                }
+            });
+        }
+        // enter が失敗した場合に残っている分. 読み終えていないので返さない.
+        vector<bool> idle(fEntries, false);
+        for (size_t i : freeSlots) {
+            idle[i] = true;
+        }
+        for (size_t i = 0; i < fEntries; i++) {
+            if (!idle[i]) {
+                discard(i);
+            }
+        }
+    }
+
+private:
+    IoUringBackend() = default;
+
+    bool setup(unsigned entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int const fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0) {
+            return false;
+        }
+        fFd = fd;
+        fEntries = params.sq_entries;
+
+        fSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        fCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool const single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            fSqRingSize = fCqRingSize = max(fSqRingSize, fCqRingSize);
+        }
+        fSqRing = mmap(nullptr, fSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (fSqRing == MAP_FAILED) {
+            fSqRing = nullptr;
+            return false;
+        }
+        if (single) {
+            fCqRing = fSqRing;
+        } else {
+            fCqRing = mmap(nullptr, fCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (fCqRing == MAP_FAILED) {
+                fCqRing = nullptr;
+                return false;
+            }
+        }
+        fSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, fSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+        fSqes = (io_uring_sqe*)sqes;
+
+        char* sq = (char*)fSqRing;
+        fSqTail = (unsigned*)(sq + params.sq_off.tail);
+        fSqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+        fSqArray = (unsigned*)(sq + params.sq_off.array);
+
+        char* cq = (char*)fCqRing;
+        fCqHead = (unsigned*)(cq + params.cq_off.head);
+        fCqTail = (unsigned*)(cq + params.cq_off.tail);
+        fCqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+        fCqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void push(int fd, iovec const* iov, size_t offset, size_t userData) {
+        unsigned const tail = __atomic_load_n(fSqTail, __ATOMIC_RELAXED);
+        unsigned const index = tail & fSqMask;
+        io_uring_sqe* sqe = &fSqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)iov;
+        sqe->len = 1;
+        sqe->off = offset;
+        sqe->user_data = userData;
+        fSqArray[index] = index;
+        __atomic_store_n(fSqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    bool enter(unsigned submit, unsigned wait) {
+        while (true) {
+            int const ret = (int)syscall(__NR_io_uring_enter, fFd, submit, wait, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret >= 0) {
+                return true;
+            }
+            if (errno != EINTR) {
+                return false;
+            }
+            // submit 済みの分は再送しない.
+            submit = 0;
+        }
+    }
+
+    template<class F>
+    void reap(F&& callback) {
+        unsigned head = __atomic_load_n(fCqHead, __ATOMIC_RELAXED);
+        unsigned const tail = __atomic_load_n(fCqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            io_uring_cqe const& cqe = fCqes[head & fCqMask];
+            callback((size_t)cqe.user_data, cqe.res);
+            head++;
+        }
+        __atomic_store_n(fCqHead, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    int fFd = -1;
+    unsigned fEntries = 0;
+    void* fSqRing = nullptr;
+    void* fCqRing = nullptr;
+    size_t fSqRingSize = 0;
+    size_t fCqRingSize = 0;
+    size_t fSqesSize = 0;
+    io_uring_sqe* fSqes = nullptr;
+    unsigned* fSqTail = nullptr;
+    unsigned fSqMask = 0;
+    unsigned* fSqArray = nullptr;
+    unsigned* fCqHead = nullptr;
+    unsigned* fCqTail = nullptr;
+    unsigned fCqMask = 0;
+    io_uring_cqe* fCqes = nullptr;
+};
+
+#endif
+
+} // namespace
+
+BufferPool::BufferPool(size_t maxBuffers)
+    : fMaxBuffers(maxBuffers)
+{
+}
+
+vector<uint8_t> BufferPool::acquire(size_t size) {
+    vector<uint8_t> buffer;
+    {
+        lock_guard<mutex> lock(fMutex);
+        if (!fBuffers.empty()) {
+            buffer.swap(fBuffers.back());
+            fBuffers.pop_back();
+        }
+    }
+    buffer.resize(size);
+    return buffer;
+}
+
+void BufferPool::release(vector<uint8_t>&& buffer) {
+    lock_guard<mutex> lock(fMutex);
+    if (fBuffers.size() >= fMaxBuffers) {
+        return;
+    }
+    buffer.clear();
+    fBuffers.push_back(std::move(buffer));
+}
+
+ChunkReader::ChunkReader(Progress* progress)
+    : fProgress(progress)
+    , fPool(1024)
+    , fStop(false)
+{
+#if defined(MCA2PNG_HAVE_IO_URING)
+    fBackend = IoUringBackend::Make(64);
+#endif
+    if (!fBackend) {
+        fBackend.reset(new PreadBackend());
+    }
+    fThread = thread([this]() { run(); });
+}
+
+ChunkReader::~ChunkReader() {
+    {
+        lock_guard<mutex> lock(fMutex);
+        fStop = true;
+    }
+    fCv.notify_all();
+    fThread.join();
+    for (int fd : fDirectories) {
+        close(fd);
+    }
+}
+
+int ChunkReader::open(fs::path const& world) {
+    int const fd = ::open((world / "chunk").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    lock_guard<mutex> lock(fMutex);
+    fDirectories.push_back(fd);
+    return (int)fDirectories.size() - 1;
+}
+
+future<vector<ChunkBuffer>> ChunkReader::fetch(int directory, vector<ChunkRequest> requests) {
+    Job job;
+    job.fRequests.swap(requests);
+    auto future = job.fPromise.get_future();
+    {
+        lock_guard<mutex> lock(fMutex);
+        job.fDirectory = 0 <= directory && directory < (int)fDirectories.size() ? fDirectories[directory] : -1;
+        fJobs.push_back(std::move(job));
+    }
+    fCv.notify_one();
+    return future;
+}
+
+void ChunkReader::recycle(vector<uint8_t>&& buffer) {
+    fPool.release(std::move(buffer));
+}
+
+char const* ChunkReader::backendName() const {
+    return fBackend->name();
+}
+
+void ChunkReader::run() {
+    while (true) {
+        Job job;
+        {
+            unique_lock<mutex> lock(fMutex);
+            fCv.wait(lock, [this]() { return fStop || !fJobs.empty(); });
+            if (fJobs.empty()) {
+                return;
+            }
+            job = std::move(fJobs.front());
+            fJobs.pop_front();
+        }
+        vector<ChunkBuffer> buffers;
+        buffers.reserve(job.fRequests.size());
+        if (job.fDirectory >= 0) {
+            fBackend->read(job.fDirectory, job.fRequests, fPool, fProgress, buffers);
+        }
+        job.fPromise.set_value(std::move(buffers));
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 読み込むファイルの大きさは, 開いてから fstat で調べる.
+struct ChunkRequest {
+    int chunkX;
+    int chunkZ;
+};
+
+struct ChunkBuffer {
+    int chunkX;
+    int chunkZ;
+    std::vector<uint8_t> data;
+};
+
+// 読み込み用バッファを使い回すためのプール.
+class BufferPool {
+public:
+    explicit BufferPool(size_t maxBuffers);
+
+    std::vector<uint8_t> acquire(size_t size);
+    void release(std::vector<uint8_t>&& buffer);
+
+private:
+    size_t const fMaxBuffers;
+    std::mutex fMutex;
+    std::vector<std::vector<uint8_t>> fBuffers;
+};
+
+class ChunkReadBackend;
+class Progress;
+
+// 専用の I/O スレッドで, 1 リージョン分のチャンクファイルをまとめて読み込む.
+// io_uring が使える環境ではバッチで submit し, そうでなければ pread で読む.
+// 複数のワールド (ディメンション) のディレクトリを 1 つのスレッドで扱える.
+// 存在しないチャンクファイルは黙って飛ばし, それ以外の理由で開けない・読めないものは progress に報告する.
+class ChunkReader {
+public:
+    explicit ChunkReader(Progress* progress);
+    ~ChunkReader();
+
+    ChunkReader(ChunkReader const&) = delete;
+    ChunkReader& operator=(ChunkReader const&) = delete;
+
+    // world/chunk を開いて, fetch に渡す番号を返す. 開けない場合は -1.
+    int open(std::filesystem::path const& world);
+
+    // 要求は受け付けた順に処理されるので, 次のリージョンの分を先に投げておけば
+    // 現在のリージョンをデコードしている間に読み込みが進む.
+    std::future<std::vector<ChunkBuffer>> fetch(int directory, std::vector<ChunkRequest> requests);
+    void recycle(std::vector<uint8_t>&& buffer);
+
+    char const* backendName() const;
+
+private:
+    struct Job {
+        int fDirectory;
+        std::vector<ChunkRequest> fRequests;
+        std::promise<std::vector<ChunkBuffer>> fPromise;
+    };
+
+    void run();
+
+private:
+    // open で開いたディレクトリ. 閉じるのはデストラクタだけ.
+    std::vector<int> fDirectories;
+    Progress* const fProgress;
+    BufferPool fPool;
+    std::unique_ptr<ChunkReadBackend> fBackend;
+
+    std::mutex fMutex;
+    std::condition_variable fCv;
+    std::deque<Job> fJobs;
+    bool fStop;
+    std::thread fThread;
+};
@@ -0,0 +1,136 @@
+#include "chunk_watcher.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+unique_ptr<ChunkWatcher> ChunkWatcher::Open(fs::path const& world) {
+    int const fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    fs::path const dir = world / "chunk";
+    // 書き込みの完了と, 一時ファイルからの rename を拾う.
+    uint32_t const mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM;
+    if (inotify_add_watch(fd, dir.c_str(), mask) < 0) {
+        close(fd);
+        return nullptr;
+    }
+    int const stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stopFd < 0) {
+        close(fd);
+        return nullptr;
+    }
+    return unique_ptr<ChunkWatcher>(new ChunkWatcher(fd, stopFd));
+}
+
+ChunkWatcher::ChunkWatcher(int fd, int stopFd)
+    : fFd(fd)
+    , fStopFd(stopFd)
+{
+}
+
+ChunkWatcher::~ChunkWatcher() {
+    close(fFd);
+    close(fStopFd);
+}
+
+void ChunkWatcher::stop() {
+    uint64_t const one = 1;
+    ssize_t const written = write(fStopFd, &one, sizeof(one));
+    (void)written;
+}
+
+bool ChunkWatcher::drain(ChunkChanges& changes) {
+    alignas(inotify_event) char buffer[64 * 1024];
+    bool any = false;
+    while (true) {
+        ssize_t const length = read(fFd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+        for (char* p = buffer; p < buffer + length;) {
+            auto const* event = (inotify_event const*)p;
+            p += sizeof(inotify_event) + event->len;
+            any = true;
+            if (event->mask & IN_Q_OVERFLOW) {
+                changes.overflow = true;
+                continue;
+            }
+            if (event->len == 0) {
+                continue;
+            }
+            int chunkX;
+            int chunkZ;
+            int consumed = 0;
+            if (sscanf(event->name, "c.%d.%d.nbt.z%n", &chunkX, &chunkZ, &consumed) == 2 && event->name[consumed] == '\0') {
+                changes.chunks.insert(make_pair(chunkX, chunkZ));
+            }
+        }
+    }
+    return any;
+}
+
+// poll の失敗や fd の異常を error に書いて true を返す. EINTR は失敗としない.
+static bool PollFailed(int ready, pollfd const& pfd, string& error) {
+    if (ready < 0) {
+        if (errno == EINTR) {
+            return false;
+        }
+        error = string("poll: ") + strerror(errno);
+        return true;
+    }
+    if (ready > 0 && (pfd.revents & (POLLERR | POLLNVAL))) {
+        error = "poll: inotify descriptor is no longer usable";
+        return true;
+    }
+    return false;
+}
+
+bool ChunkWatcher::wait(chrono::milliseconds quiet, chrono::milliseconds maxDelay, ChunkChanges& changes, string& error) {
+    changes = ChunkChanges();
+    error.clear();
+    // [0] が inotify, [1] が stop の通知.
+    pollfd pfds[2];
+    pfds[0].fd = fFd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = fStopFd;
+    pfds[1].events = POLLIN;
+    auto stopped = [&pfds](int ready) {
+        return ready > 0 && (pfds[1].revents & POLLIN);
+    };
+    while (changes.chunks.empty() && !changes.overflow) {
+        int const ready = poll(pfds, 2, -1);
+        if (stopped(ready) || PollFailed(ready, pfds[0], error)) {
+            return false;
+        }
+        drain(changes);
+    }
+    auto const deadline = chrono::steady_clock::now() + maxDelay;
+    while (true) {
+        auto const now = chrono::steady_clock::now();
+        if (now >= deadline) {
+            break;
+        }
+        auto const timeout = min(quiet, chrono::duration_cast<chrono::milliseconds>(deadline - now));
+        int const ready = poll(pfds, 2, (int)timeout.count());
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (stopped(ready)) {
+            return false;
+        }
+        // 集めた分は返し, 失敗は次の呼び出しで報告する.
+        if (ready <= 0 || (pfds[0].revents & (POLLERR | POLLNVAL)) || !drain(changes)) {
+            break;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+
+struct ChunkChanges {
+    // 書き込み・作成・削除されたチャンクの座標
+    std::set<std::pair<int, int>> chunks;
+    // イベントが溢れて取りこぼした. 全体を読み直す必要がある.
+    bool overflow = false;
+};
+
+// world/chunk を inotify で監視する. セーブ時には多数のチャンクが続けて書かれるので,
+// イベントが途切れるまでまとめてから返す.
+class ChunkWatcher {
+public:
+    // inotify が使えない場合は nullptr を返す.
+    static std::unique_ptr<ChunkWatcher> Open(std::filesystem::path const& world);
+    ~ChunkWatcher();
+
+    ChunkWatcher(ChunkWatcher const&) = delete;
+    ChunkWatcher& operator=(ChunkWatcher const&) = delete;
+
+    // 最初の変更が来るまで待ち, その後 quiet の間イベントが無いか, maxDelay が経過するまで集める.
+    // 監視を続けられない場合は false を返し, error に理由を入れる. stop された場合は error を空にして false.
+    bool wait(std::chrono::milliseconds quiet, std::chrono::milliseconds maxDelay, ChunkChanges& changes, std::string& error);
+    // 他のスレッドで待っている wait を戻す. 以降の wait もすぐに戻る.
+    void stop();
+
+private:
+    ChunkWatcher(int fd, int stopFd);
+    // 読めるイベントを全て読む. イベントが無ければ false.
+    bool drain(ChunkChanges& changes);
+
+private:
+    int const fFd;
+    // stop で書き込む eventfd
+    int const fStopFd;
+};
@@ -0,0 +1,44 @@
+#include "color_tables.h"
+#include "colormap/colormap.h"
+
+#include <algorithm>
+#include <math.h>
+
+static float BrightnessByDistanceFromLandmark(float distance) {
+    int const r = ColorTables::kVisibleRadius;
+    if (distance <= r) {
+        return 1;
+    } else if (distance > 2 * r) {
+        return 0;
+    } else {
+        float x = 1 - (distance - r) / r;
+        return (erff(sqrtf(M_PI) * 2 * x - 2) + 1) * 0.5;
+    }
+}
+
+ColorTables const& ColorTables::Get() {
+    static ColorTables const sTables;
+    return sTables;
+}
+
+ColorTables::ColorTables() {
+    static float const diffusion = 0.02;
+    Color const water(69, 91, 211);
+    for (int depth = 0; depth < kWaterDepthLimit; depth++) {
+        Rgba8 c = Rgba8::FromColor(water.diffuse(diffusion, depth));
+        fWater[depth] = Rgba8::Add(c, Rgba8::Make(0, 0, 0, 51));
+    }
+
+    colormap::kbinani::Altitude colormap;
+    for (int i = 0; i < kElevationCount; i++) {
+        int const elevation = kMinElevation + i;
+        float const v = std::min(std::max((elevation - 63.0) / 193.0, 0.0), 1.0);
+        auto mapped = colormap.getColor(v);
+        fGrass[i] = Rgba8::FromColor(Color::FromFloat(mapped.r, mapped.g, mapped.b, 1));
+    }
+
+    int64_t const r2 = kVisibleRadius * kVisibleRadius;
+    for (int i = 0; i < kFalloffCount; i++) {
+        fFalloff[i] = BrightnessByDistanceFromLandmark(sqrtf((float)(r2 + 1 + i)));
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "rgba8.h"
+
+#include <array>
+#include <cstdint>
+
+// 水深, 高度, ランドマークからの距離だけで決まる色や明るさの表. 起動時に一度だけ作る.
+class ColorTables {
+public:
+    static int const kVisibleRadius = 128;
+
+    static ColorTables const& Get();
+
+    Rgba8 water(int depth) const {
+        return fWater[depth < kWaterDepthLimit ? depth : kWaterDepthLimit - 1];
+    }
+
+    Rgba8 grass(int elevation) const {
+        int const i = elevation - kMinElevation;
+        return fGrass[i < 0 ? 0 : (i < kElevationCount ? i : kElevationCount - 1)];
+    }
+
+    // ランドマークからの距離の 2 乗に対する明るさ.
+    float landmarkBrightness(int64_t distanceSquared) const {
+        if (distanceSquared <= kVisibleRadius * kVisibleRadius) {
+            return 1;
+        }
+        int64_t const i = distanceSquared - kVisibleRadius * kVisibleRadius - 1;
+        return i < kFalloffCount ? fFalloff[i] : 0;
+    }
+
+private:
+    ColorTables();
+
+private:
+    // これより深い水は完全に透明な色になる (10^(-0.02 * 136) * 255 < 0.5).
+    static int const kWaterDepthLimit = 256;
+    static int const kMinElevation = -64;
+    static int const kElevationCount = 320 - kMinElevation + 1;
+    static int const kFalloffCount = 4 * kVisibleRadius * kVisibleRadius - kVisibleRadius * kVisibleRadius;
+
+    std::array<Rgba8, kWaterDepthLimit> fWater;
+    std::array<Rgba8, kElevationCount> fGrass;
+    std::array<float, kFalloffCount> fFalloff;
+};
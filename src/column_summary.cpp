@@ -0,0 +1,101 @@
+#include "column_summary.h"
+
+#include <string.h>
+#include <zlib.h>
+
+#include <bit>
+
+using namespace std;
+
+static_assert(endian::native == endian::little, "column summaries are written in host byte order");
+
+namespace {
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    int32_t regionX;
+    int32_t regionZ;
+    int32_t scale;
+    uint64_t reserved;
+};
+static_assert(sizeof(Header) == 32, "Header must be 32 bytes");
+
+char const kMagic[8] = "MCA2COL";
+uint32_t const kVersion = 3;
+
+size_t PayloadSize(int width) {
+    size_t const cells = (size_t)width * width;
+    return cells * (sizeof(int16_t) + sizeof(uint8_t) + sizeof(Rgba8));
+}
+
+} // namespace
+
+void ColumnSummary::reset(int regionX, int regionZ, int scale) {
+    this->regionX = regionX;
+    this->regionZ = regionZ;
+    this->scale = scale;
+    width = 512 / scale + 1;
+    size_t const cells = (size_t)width * width;
+    elevation.assign(cells, 0);
+    waterDepth.assign(cells, 0);
+    color.assign(cells, Rgba8::Make(0, 0, 0));
+}
+
+bool EncodeColumnSummary(ColumnSummary const& summary, vector<uint8_t>& out) {
+    size_t const cells = (size_t)summary.width * summary.width;
+    vector<uint8_t> payload(PayloadSize(summary.width));
+    uint8_t* p = payload.data();
+    // 同じ種類の値を続けて並べた方がよく縮む.
+    memcpy(p, summary.elevation.data(), cells * sizeof(int16_t));
+    p += cells * sizeof(int16_t);
+    memcpy(p, summary.waterDepth.data(), cells);
+    p += cells;
+    memcpy(p, summary.color.data(), cells * sizeof(Rgba8));
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.regionX = summary.regionX;
+    header.regionZ = summary.regionZ;
+    header.scale = summary.scale;
+
+    uLongf compressedSize = compressBound((uLong)payload.size());
+    out.resize(sizeof(Header) + compressedSize);
+    memcpy(out.data(), &header, sizeof(Header));
+    // 書く度に圧縮するので, 速さを優先する.
+    if (compress2(out.data() + sizeof(Header), &compressedSize, payload.data(), (uLong)payload.size(), Z_BEST_SPEED) != Z_OK) {
+        return false;
+    }
+    out.resize(sizeof(Header) + compressedSize);
+    return true;
+}
+
+bool DecodeColumnSummary(vector<uint8_t> const& in, ColumnSummary& summary) {
+    if (in.size() < sizeof(Header)) {
+        return false;
+    }
+    Header header;
+    memcpy(&header, in.data(), sizeof(Header));
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion) {
+        return false;
+    }
+    if (header.scale != 1 && header.scale != 2 && header.scale != 4 && header.scale != 8) {
+        return false;
+    }
+    summary.reset(header.regionX, header.regionZ, header.scale);
+    size_t const cells = (size_t)summary.width * summary.width;
+    vector<uint8_t> payload(PayloadSize(summary.width));
+    uLongf size = (uLongf)payload.size();
+    if (uncompress(payload.data(), &size, in.data() + sizeof(Header), (uLong)(in.size() - sizeof(Header))) != Z_OK || size != payload.size()) {
+        return false;
+    }
+    uint8_t const* p = payload.data();
+    memcpy(summary.elevation.data(), p, cells * sizeof(int16_t));
+    p += cells * sizeof(int16_t);
+    memcpy(summary.waterDepth.data(), p, cells);
+    p += cells;
+    memcpy(summary.color.data(), p, cells * sizeof(Rgba8));
+    return true;
+}
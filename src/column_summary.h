@@ -0,0 +1,29 @@
+#pragma once
+
+#include "rgba8.h"
+
+#include <cstdint>
+#include <vector>
+
+// 陰影を付ける前の, 列毎の走査結果. 地図の色と陰影はこれだけから決まるので, ランドマークや
+// 陰影の付け方を変えた場合はチャンクを読み直さずに描き直せる. 北側 1 行・西側 1 列の境界を含む
+// width 四方の行優先で, 境界の列は elevation だけが意味を持つ.
+struct ColumnSummary {
+    int regionX = 0;
+    int regionZ = 0;
+    int scale = 1;
+    // 512 / scale + 1. 0 なら空.
+    int width = 0;
+    std::vector<int16_t> elevation;
+    std::vector<uint8_t> waterDepth;
+    // 陰影を付ける前の地図の色. 半透明なブロックは層毎に重ねるので, 不透明なブロックの色と
+    // 半透明な色を別々に残しても丸めの違いで正確には求まらない. 描き直しにはこれだけを使う.
+    std::vector<Rgba8> color;
+
+    void reset(int regionX, int regionZ, int scale);
+};
+
+// r.X.Z.columns の中身. 32 バイトのヘッダーに, 各配列を順に並べて zlib で圧縮したものが続く.
+bool EncodeColumnSummary(ColumnSummary const& summary, std::vector<uint8_t>& out);
+// 壊れている場合や, 形式が違う場合は false.
+bool DecodeColumnSummary(std::vector<uint8_t> const& in, ColumnSummary& summary);
@@ -0,0 +1,134 @@
+#include "layer_writer.h"
+
+#include "lodepng.h"
+#include "output_file.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+// 高さ. リトルエンディアンの int16 を行優先に並べただけのもの.
+class HeightWriter : public LayerWriter {
+public:
+    char const* suffix() const override {
+        return "height.raw";
+    }
+
+    void prepare(LayerData& data, mca2png::Layers& layers) const override {
+        data.height.assign(data.size * data.size, 0);
+        layers.height = data.height.data();
+    }
+
+    bool encode(LayerData const& data, vector<unsigned char>& out, string&) const override {
+        out.resize(data.height.size() * 2);
+        for (size_t i = 0; i < data.height.size(); i++) {
+            uint16_t const v = (uint16_t)data.height[i];
+            out[i * 2] = (unsigned char)(v & 0xff);
+            out[i * 2 + 1] = (unsigned char)(v >> 8);
+        }
+        return true;
+    }
+};
+
+// 水深. 8bit グレースケールの PNG.
+class WaterDepthWriter : public LayerWriter {
+public:
+    char const* suffix() const override {
+        return "water.png";
+    }
+
+    void prepare(LayerData& data, mca2png::Layers& layers) const override {
+        data.waterDepth.assign(data.size * data.size, 0);
+        layers.waterDepth = data.waterDepth.data();
+    }
+
+    bool encode(LayerData const& data, vector<unsigned char>& out, string& error) const override {
+        if (unsigned e = lodepng::encode(out, data.waterDepth.data(), data.size, data.size, LCT_GREY, 8); e != 0) {
+            error = lodepng_error_text(e);
+            return false;
+        }
+        return true;
+    }
+};
+
+// 名前の番号. 16bit グレースケールの PNG と, 番号と名前の対応表 (タブ区切り).
+class NameIdWriter : public LayerWriter {
+protected:
+    static bool Encode(vector<uint16_t> const& ids, int size, vector<unsigned char>& out, string& error) {
+        // PNG の 16bit のサンプルはビッグエンディアン.
+        vector<unsigned char> in(ids.size() * 2);
+        for (size_t i = 0; i < ids.size(); i++) {
+            in[i * 2] = (unsigned char)(ids[i] >> 8);
+            in[i * 2 + 1] = (unsigned char)(ids[i] & 0xff);
+        }
+        if (unsigned e = lodepng::encode(out, in, size, size, LCT_GREY, 16); e != 0) {
+            error = lodepng_error_text(e);
+            return false;
+        }
+        return true;
+    }
+
+    static bool WriteLegend(vector<string> const& names, fs::path const& file, string& error) {
+        string tsv = "0\t\n";
+        for (size_t i = 0; i < names.size(); i++) {
+            tsv += to_string(i + 1) + "\t" + names[i] + "\n";
+        }
+        return WriteFileAtomically(file.string(), tsv.data(), tsv.size(), error);
+    }
+};
+
+class BiomeWriter : public NameIdWriter {
+public:
+    char const* suffix() const override {
+        return "biome.png";
+    }
+
+    void prepare(LayerData& data, mca2png::Layers& layers) const override {
+        data.biome.assign(data.size * data.size, 0);
+        layers.biome = data.biome.data();
+    }
+
+    bool encode(LayerData const& data, vector<unsigned char>& out, string& error) const override {
+        return Encode(data.biome, data.size, out, error);
+    }
+
+    bool writeLegend(mca2png::World const& world, fs::path const& directory, string& error) const override {
+        return WriteLegend(world.biomeNames(), directory / "biomes.tsv", error);
+    }
+};
+
+class TopBlockWriter : public NameIdWriter {
+public:
+    char const* suffix() const override {
+        return "block.png";
+    }
+
+    void prepare(LayerData& data, mca2png::Layers& layers) const override {
+        data.topBlock.assign(data.size * data.size, 0);
+        layers.topBlock = data.topBlock.data();
+    }
+
+    bool encode(LayerData const& data, vector<unsigned char>& out, string& error) const override {
+        return Encode(data.topBlock, data.size, out, error);
+    }
+
+    bool writeLegend(mca2png::World const& world, fs::path const& directory, string& error) const override {
+        return WriteLegend(world.blockNames(), directory / "blocks.tsv", error);
+    }
+};
+
+} // namespace
+
+unique_ptr<LayerWriter> MakeLayerWriter(string const& name) {
+    if (name == "height") {
+        return make_unique<HeightWriter>();
+    } else if (name == "water") {
+        return make_unique<WaterDepthWriter>();
+    } else if (name == "biome") {
+        return make_unique<BiomeWriter>();
+    } else if (name == "block") {
+        return make_unique<TopBlockWriter>();
+    }
+    return nullptr;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "mca2png.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// リージョン 1 つ分の追加のレイヤー. 必要なものだけを LayerWriter::prepare で確保する.
+struct LayerData {
+    int size = 0;
+    std::vector<int16_t> height;
+    std::vector<uint8_t> waterDepth;
+    std::vector<uint16_t> biome;
+    std::vector<uint16_t> topBlock;
+};
+
+// 追加のレイヤー 1 つ分の出力. リージョン毎に r.X.Z.<suffix> を書く.
+class LayerWriter {
+public:
+    virtual ~LayerWriter() {}
+
+    // "height.raw" など
+    virtual char const* suffix() const = 0;
+    // size 四方のバッファを確保して, 描画に渡す layers に繋ぐ.
+    virtual void prepare(LayerData& data, mca2png::Layers& layers) const = 0;
+    virtual bool encode(LayerData const& data, std::vector<unsigned char>& out, std::string& error) const = 0;
+    // 番号で表すレイヤーは, 番号と名前の対応表を directory に書く. その時点までに描画したものが全て載る.
+    virtual bool writeLegend(mca2png::World const& /* world */, std::filesystem::path const& /* directory */, std::string& /* error */) const {
+        return true;
+    }
+};
+
+// "height", "water", "biome", "block" のいずれか. 知らない名前なら nullptr.
+std::unique_ptr<LayerWriter> MakeLayerWriter(std::string const& name);
@@ -1,506 +1,454 @@
 #include <iostream>
-#include "minecraft-file.hpp"
-#include <math.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
 #include <set>
 #include <fstream>
+#include <array>
+#include <optional>
+#include <thread>
 #include "zopflipng_lib.h"
 #include "lodepng.h"
-#include "colormap/colormap.h"
 #include <hwm/task/task_queue.hpp>
-#include "block_color.h"
+#include "mca2png.h"
+#include "chunk_io.h"
+#include "perf_counters.h"
+#include "alloc_profiler.h"
+#include "progress.h"
+#include "png_encoder.h"
+#include "output_file.h"
+#include "chunk_watcher.h"
+#include "region_queue.h"
+#include "tile_server.h"
+#include "layer_writer.h"
+#include "raw_raster.h"
 
 using namespace std;
-using namespace mcfile;
-using namespace mcfile::je;
 namespace fs = std::filesystem;
 
-struct Landmark {
-    int dimension;
-    int x;
-    int z;
+struct EncodeOptions {
+    bool zopfli;
+    bool parallel;
+    // PNG の代わりに raw_raster.h の形式で書く. zopfli と parallel は使わない.
+    bool raw;
+    // parallel の場合に deflate を分担させるプール
+    hwm::task_queue* pool;
 };
 
-static int const kVisibleRadius = 128;
-static vector<Landmark> kLandmarks;
-
-static float BrightnessByDistanceFromLandmark(float distance) {
-    if (distance <= kVisibleRadius) {
-        return 1;
-    } else if (distance > 2 * kVisibleRadius) {
-        return 0;
+static bool EncodeImage(vector<uint32_t>& img, int width, int height, EncodeOptions const& options, int regionX, int regionZ, Progress& progress, vector<unsigned char>& out) {
+    AllocScope encodeAllocScope(AllocStage::Encode);
+    PerfScope scope(PerfStage::Encode);
+    if (options.parallel) {
+        if (!EncodePngParallel(img.data(), width, height, *options.pool, out)) {
+            progress.error(regionX, regionZ, "encode", "parallel deflate failed");
+            return false;
+        }
+        vector<uint32_t>().swap(img);
     } else {
-        float x = 1 - (distance - kVisibleRadius) / kVisibleRadius;
-        return (erff(sqrtf(M_PI) * 2 * x - 2) + 1) * 0.5;
+        vector<unsigned char> in;
+        copy_n((unsigned char*)img.data(), img.size() * sizeof(uint32_t), back_inserter(in));
+        vector<uint32_t>().swap(img);
+        if (unsigned error = lodepng::encode(out, in, width, height); error != 0) {
+            progress.error(regionX, regionZ, "encode", lodepng_error_text(error));
+            return false;
+        }
     }
-}
 
-static int SkyLevel(int dimension, Chunk const& chunk, int x, int z) {
-    if (dimension != -1) {
-        return chunk.maxBlockY();
-    }
-    for (int y = 127; y >= 0; y--) {
-        auto block = chunk.blockIdAt(x, y, z);
-        if (!block) continue;
-        if (block == mcfile::blocks::minecraft::air) {
-            return y;
+    if (options.zopfli) {
+        AllocScope allocScope(AllocStage::Zopfli);
+        vector<unsigned char> result;
+        ZopfliPNGOptions opt;
+        opt.verbose = false;
+        if (ZopfliPNGOptimize(out, opt, false, &result) != 0) {
+            progress.error(regionX, regionZ, "zopfli", "ZopfliPNGOptimize failed");
+            return false;
         }
+        out.swap(result);
     }
-    return 0;
+    return true;
 }
 
-static bool IsSlab(Block const& block) {
-    return block.fName.ends_with("_slab");
+// r.X.Z.png の隣に置く r.X.Z.<suffix>
+static string LayerPath(string const& png, LayerWriter const& writer) {
+    return fs::path(png).replace_extension(writer.suffix()).string();
 }
 
-static bool IsStairs(Block const& block) {
-    return block.fName.ends_with("_stairs");
+static string ColumnsPath(string const& png) {
+    return fs::path(png).replace_extension("columns").string();
 }
 
-static bool IsTrapdoor(Block const& block) {
-    return block.fName.ends_with("_trapdoor");
-}
+// 描画した img (raw の場合は altitude も) とレイヤーをエンコードして書き出す. 前回と同じ内容なら何もしない.
+// preview の場合は, 後で同じ場所に書く本番の画像を省かないように, ハッシュを消しておく.
+// options.raw の場合, png は r.X.Z.raw.
+static void WriteRegionImage(int regionX, int regionZ, int scale, bool preview, vector<uint32_t>& img, vector<int16_t> const& altitude, LayerData const& layerData, string const& png, EncodeOptions const& options, vector<unique_ptr<LayerWriter>> const& layerWriters, Progress& progress) {
+    int const size = mca2png::kRegionSize / scale;
+    string const sidecar = png + ".hash";
 
-static bool IsWaterLike(Block const& block) {
-    string const& name = block.fName;
-    if (name == "minecraft:water" || name == "minecraft:bubble_column" || name == "minecraft:kelp" || name == "minecraft:seagrass" || name == "minecraft:tall_seagrass") {
-        return true;
+    // 前回と同じ画素を同じ設定でエンコードするだけなら, エンコードも書き込みも省く.
+    // レイヤーのバッファはどれも 4 バイトの倍数の大きさなので, 画素と同じように続けてハッシュに含める.
+    uint64_t const encoderTag = options.raw ? 4 | ((uint64_t)scale << 8) : (options.zopfli ? 1 : 0) | (options.parallel ? 2 : 0) | ((uint64_t)scale << 8);
+    uint64_t hash = HashPixels(img.data(), img.size(), encoderTag);
+    hash = HashPixels((uint32_t const*)altitude.data(), altitude.size() * sizeof(int16_t) / 4, hash);
+    hash = HashPixels((uint32_t const*)layerData.height.data(), layerData.height.size() * sizeof(int16_t) / 4, hash);
+    hash = HashPixels((uint32_t const*)layerData.waterDepth.data(), layerData.waterDepth.size() / 4, hash);
+    hash = HashPixels((uint32_t const*)layerData.biome.data(), layerData.biome.size() * sizeof(uint16_t) / 4, hash);
+    hash = HashPixels((uint32_t const*)layerData.topBlock.data(), layerData.topBlock.size() * sizeof(uint16_t) / 4, hash);
+    bool const layersExist = all_of(layerWriters.begin(), layerWriters.end(), [&png](auto const& writer) {
+        return fs::exists(LayerPath(png, *writer));
+    });
+    if (uint64_t stored; !preview && ReadSidecarHash(sidecar, stored) && stored == hash && fs::exists(png) && layersExist) {
+        return;
     }
 
-    if (block.property("waterlogged") != "true") {
-        return false;
+    vector<unsigned char> out;
+    if (options.raw) {
+        PerfScope scope(PerfStage::Encode);
+        EncodeRawRaster(img.data(), altitude.data(), size, size, regionX * mca2png::kRegionSize, regionZ * mca2png::kRegionSize, scale, out);
+    } else if (!EncodeImage(img, size, size, options, regionX, regionZ, progress, out)) {
+        return;
     }
 
-    if (IsSlab(block) && block.property("type") == "top") {
-        return false;
-    } else if (IsStairs(block) && block.property("half") == "top") {
-        return false;
-    } else if (block.fName == "scaffolding") {
-        return false;
-    } else if (IsTrapdoor(block) && block.property("open") == "close") {
-        return false;
+    string error;
+    if (preview) {
+        error_code ec;
+        fs::remove(sidecar, ec);
+    }
+    if (!WriteFileAtomically(png, out.data(), out.size(), error)) {
+        progress.error(regionX, regionZ, "write", error);
+        return;
+    }
+    if (!preview) {
+        for (auto const& writer : layerWriters) {
+            vector<unsigned char> encoded;
+            if (!writer->encode(layerData, encoded, error)) {
+                progress.error(regionX, regionZ, "encode", error);
+                return;
+            }
+            if (!WriteFileAtomically(LayerPath(png, *writer), encoded.data(), encoded.size(), error)) {
+                progress.error(regionX, regionZ, "write", error);
+                return;
+            }
+        }
+    }
+    if (!preview && !WriteSidecarHash(sidecar, hash, error)) {
+        progress.error(regionX, regionZ, "write", error);
     }
-    
-    return true;
 }
 
-class TranslucentBlock {
-private:
-    TranslucentBlock() = delete;
-    
-public:
-    static Color Air() {
-        return Color(0, 0, 0, 0);
-    }
-    
-    static Color Opaque() {
-        return Color(0, 0, 0, 255);
-    }
-    
-    static Color FromBlock(Block const& block) {
-        if (IsWaterLike(block)) {
-            return Color::FromFloat(69 / 255.0f, 91 / 255.0f, 211 / 255.0f, 0);
-        }
-        blocks::BlockId blockId = blocks::FromName(block.fName);
-        int const stainedGlassAlpha = (int)(255 * 0.5);
-        switch (blockId) {
-            case blocks::minecraft::air:
-            case blocks::minecraft::cave_air:
-                return Air();
-            case blocks::minecraft::glass:
-            case blocks::minecraft::glass_pane:
-                return Color(255, 255, 255, 4);
-            case blocks::minecraft::white_stained_glass:
-            case blocks::minecraft::white_stained_glass_pane:
-                return Color(255, 255, 255, stainedGlassAlpha);
-            case blocks::minecraft::orange_stained_glass:
-            case blocks::minecraft::orange_stained_glass_pane:
-                return Color(255, 165, 0, stainedGlassAlpha);
-            case blocks::minecraft::magenta_stained_glass:
-            case blocks::minecraft::magenta_stained_glass_pane:
-                return Color(255, 0, 255, stainedGlassAlpha);
-            case blocks::minecraft::light_blue_stained_glass:
-            case blocks::minecraft::light_blue_stained_glass_pane:
-                return Color(142, 209, 224, stainedGlassAlpha);
-            case blocks::minecraft::yellow_stained_glass:
-            case blocks::minecraft::yellow_stained_glass_pane:
-                return Color(227, 199, 0, stainedGlassAlpha);
-            case blocks::minecraft::lime_stained_glass:
-            case blocks::minecraft::lime_stained_glass_pane:
-                return Color(0, 255, 0, stainedGlassAlpha);
-            case blocks::minecraft::pink_stained_glass:
-            case blocks::minecraft::pink_stained_glass_pane:
-                return Color(255, 102, 153, stainedGlassAlpha);
-            case blocks::minecraft::gray_stained_glass:
-            case blocks::minecraft::gray_stained_glass_pane:
-                return Color(118, 118, 118, stainedGlassAlpha);
-            case blocks::minecraft::light_gray_stained_glass:
-            case blocks::minecraft::light_gray_stained_glass_pane:
-                return Color(211, 211, 211, stainedGlassAlpha);
-            case blocks::minecraft::cyan_stained_glass:
-            case blocks::minecraft::cyan_stained_glass_pane:
-                return Color(0, 255, 255, stainedGlassAlpha);
-            case blocks::minecraft::purple_stained_glass:
-            case blocks::minecraft::purple_stained_glass_pane:
-                return Color(128, 0, 128, stainedGlassAlpha);
-            case blocks::minecraft::blue_stained_glass:
-            case blocks::minecraft::blue_stained_glass_pane:
-                return Color(0, 0, 255, stainedGlassAlpha);
-            case blocks::minecraft::brown_stained_glass:
-            case blocks::minecraft::brown_stained_glass_pane:
-                return Color(139, 69, 19, stainedGlassAlpha);
-            case blocks::minecraft::green_stained_glass:
-            case blocks::minecraft::green_stained_glass_pane:
-                return Color(0, 128, 0, stainedGlassAlpha);
-            case blocks::minecraft::red_stained_glass:
-            case blocks::minecraft::red_stained_glass_pane:
-                return Color(255, 0, 0, stainedGlassAlpha);
-            case blocks::minecraft::black_stained_glass:
-            case blocks::minecraft::black_stained_glass_pane:
-                return Color(0, 0, 0, stainedGlassAlpha);
-            default:
-                break;
-        }
-        if (IsTransparentBlock(blockId)) {
-            return Air();
+// preview の場合は縮小画像を仮に書き出すだけなので, 追加のレイヤーと走査結果は書かない.
+// 既に画像のあるリージョンは呼び出し側で preview の対象から外しておく. saveColumns の場合は, 陰影を付ける前の走査結果を r.X.Z.columns に書く.
+static void RegionToPng2(mca2png::World& world, int dimension, int regionX, int regionZ, int scale, bool preview, vector<ChunkBuffer> buffers, string png, EncodeOptions const& options, vector<unique_ptr<LayerWriter>> const& layerWriters, bool saveColumns, Progress& progress) {
+    int const size = mca2png::kRegionSize / scale;
+    vector<uint32_t> img(size * size);
+    vector<int16_t> altitude(options.raw ? size * size : 0);
+    LayerData layerData;
+    layerData.size = size;
+    mca2png::Layers layers;
+    ColumnSummary columns;
+    if (!preview) {
+        for (auto const& writer : layerWriters) {
+            writer->prepare(layerData, layers);
         }
-        if (IsPlantBlock(blockId)) {
-            return Air();
+        if (saveColumns) {
+            layers.columns = &columns;
         }
-        if (IsTrapdoor(block) && block.property("open") == "true") {
-            return Air();
+    }
+    bool const rendered = world.renderRegion(dimension, regionX, regionZ, move(buffers), img.data(), options.raw ? altitude.data() : nullptr, scale, layers);
+    // 真っ暗なリージョンも, 後でランドマークを変えて描き直せるように走査結果は残す.
+    if (columns.width > 0) {
+        vector<uint8_t> encoded;
+        string error;
+        if (!EncodeColumnSummary(columns, encoded)) {
+            progress.error(regionX, regionZ, "encode", "cannot compress column summary");
+        } else if (!WriteFileAtomically(ColumnsPath(png), encoded.data(), encoded.size(), error)) {
+            progress.error(regionX, regionZ, "write", error);
         }
-        return Opaque();
     }
-
-    Color color;
-};
-
-template<class T>
-static T Clamp(T v, T min, T max) {
-    return std::min(std::max(v, min), max);
+    if (!rendered) {
+        return;
+    }
+    WriteRegionImage(regionX, regionZ, scale, preview, img, altitude, layerData, png, options, layerWriters, progress);
 }
 
-static int Altitude(int dimension, Chunk const& chunk, int x, int z) {
-    int const maxY = SkyLevel(dimension, chunk, x, z);
-    int const minY = chunk.minBlockY();
-    int waterDepth = 0;
-    for (int y = maxY; y >= minY; y--) {
-        auto const& block = chunk.blockAt(x, y, z);
-        if (!block) {
-            continue;
-        }
-        if (IsWaterLike(*block)) {
-            waterDepth++;
-        }
-        auto tb = TranslucentBlock::FromBlock(*block);
-        if (tb.fA >= 1) {
-            return y;
+// directory にある r.X.Z.columns のリージョン座標.
+static vector<pair<int, int>> ColumnsRegions(fs::path const& directory) {
+    vector<pair<int, int>> regions;
+    error_code ec;
+    for (auto const& entry : fs::directory_iterator(directory.empty() ? fs::path(".") : directory, ec)) {
+        string const name = entry.path().filename().string();
+        int x;
+        int z;
+        int consumed = 0;
+        if (sscanf(name.c_str(), "r.%d.%d.columns%n", &x, &z, &consumed) == 2 && consumed == (int)name.size()) {
+            regions.push_back(make_pair(x, z));
         }
     }
-    return 0;
+    return regions;
 }
 
-static Color DiffuseBlockColor(Color blockColor, int waterDepth, vector<Color> const& pillar, int pillarHeight) {
-    Color base = blockColor;
-    if (waterDepth > 0) {
-        static float const diffusion = 0.02;
-        Color water = Color(69, 91, 211).diffuse(diffusion, waterDepth);
-        base = Color::Add(water, Color(0, 0, 0).withAlphaComponent(0.2));
+// 描画の時に --save-columns で書いた r.X.Z.columns から陰影だけを付け直す. 追加のレイヤーは変わらないので書かない.
+static void ReshadeRegion(mca2png::World& world, int dimension, int regionX, int regionZ, string const& png, EncodeOptions const& options, Progress& progress) {
+    string const path = ColumnsPath(png);
+    ifstream stream(path, ios::binary);
+    vector<uint8_t> bytes((istreambuf_iterator<char>(stream)), istreambuf_iterator<char>());
+    ColumnSummary columns;
+    if (!stream || !DecodeColumnSummary(bytes, columns) || columns.regionX != regionX || columns.regionZ != regionZ) {
+        progress.error(regionX, regionZ, "reshade", "cannot read " + path);
+        return;
     }
-    Color result = base;
-    for (int i = pillarHeight - 1; i >= 0; i--) {
-        Color c = pillar[i];
-        if (c.fA > 0) {
-            result = Color::Blend(c, result);
-        }
+    int const size = mca2png::kRegionSize / columns.scale;
+    vector<uint32_t> img(size * size);
+    vector<int16_t> altitude(options.raw ? size * size : 0);
+    if (!world.reshade(dimension, columns, img.data(), options.raw ? altitude.data() : nullptr)) {
+        // 真っ暗になった. 前のランドマークで描いた画像を残さない.
+        error_code ec;
+        fs::remove(png, ec);
+        fs::remove(png + ".hash", ec);
+        return;
     }
-    return result;
+    static vector<unique_ptr<LayerWriter>> const kNoLayers;
+    WriteRegionImage(regionX, regionZ, columns.scale, false, img, altitude, LayerData(), png, options, kNoLayers, progress);
 }
 
-struct ChunkResult {
-    unordered_map<size_t, uint8_t> altitude;
-    unordered_map<size_t, Color> pixels;
-};
+static void PrintDescription() {
+    cerr << "mca2png -w [world directory] [-x [region x, or range x0:x1] -z [region z, or range z0:z1]; all regions if omitted] -o [output directory] -l [path to 'landmarks.tsv'] -d [dimension; o:overworld, n:nether, e:theEnd, all, or a list such as o,n. With several dimensions, -w is a vanilla world directory (DIM-1, DIM1 for the nether and the end) and images go into overworld/, nether/ and end/ under -o] [--dimension (N=PATH; read dimension N (o, n, e or 0, -1, 1) from PATH/chunk instead of the vanilla location under -w; may be repeated, and -w may be omitted when every dimension has one)] [-m(minify png with zopfli)] [-p(print hardware performance counters per stage; Linux only)] [-i (progress report interval in seconds)] [-e (error log file; JSON lines)] [--max-memory (memory budget; 512M, 4G, ...)] [--max-chunks (chunks in flight per region)] [--max-regions (regions in flight)] [--list-regions(print existing regions and exit)] [--parallel-encode(filter and deflate png in parallel bands)] [--watch(keep running and re-render regions when chunk files change, until SIGINT or SIGTERM; Linux only)] [--serve (serve r.X.Z.png tiles on 127.0.0.1:PORT, rendering them on demand, until SIGINT or SIGTERM; -o is not needed)] [--cache-size (memory for cached tiles with --serve; 256M by default)] [--bbox (render only the block rectangle x0,z0,x1,z1 into one image, at most 16384 blocks per side; -o may name the png or raw file)] [--scale (1/2, 1/4 or 1/8; sample every Nth column and write 256, 128 or 64 pixel tiles)] [--progressive(with --scale, write the scaled tiles of every region first, then replace them with full resolution ones)] [--layers (comma separated extra layers taken from the same pass: height (r.X.Z.height.raw; little endian int16), water (r.X.Z.water.png; depth in blocks), biome (r.X.Z.biome.png; 16 bit ids listed in biomes.tsv), block (r.X.Z.block.png; top block ids listed in blocks.tsv))] [--format (png, or raw: r.X.Z.raw with a 64 byte header, RGBA8 and int16 altitude at 64 byte aligned offsets, for mmap)] [--save-columns(also write the unshaded per-column colours, elevation and water depth to r.X.Z.columns; regions far from landmarks are scanned too)] [--reshade(redraw the images of every r.X.Z.columns file in -o without reading chunks, e.g. after editing landmarks.tsv; images that become completely dark are removed)]" << endl;
+}
 
-static optional<ChunkResult> Render(string world, int dimension, int chunkX, int chunkZ, int minX, int minZ, int width) {
-    Block const kGrassBlock(blocks::minecraft::grass_block);
-    Block const kUnknownBlock(blocks::unknown);
-
-    fs::path chunkFilePath = fs::path(world) / "chunk" / Region::GetDefaultCompressedChunkNbtFileName(chunkX, chunkZ);
-    if (!fs::exists(chunkFilePath)) {
-        return nullopt;
-    }
-    shared_ptr<Chunk> chunk = Chunk::LoadFromCompressedChunkNbtFile(chunkFilePath, chunkX, chunkZ);
-    if (!chunk) {
-        return nullopt;
-    }
-    vector<Color> translucentBlockPillar(chunk->maxBlockY() - chunk->minBlockY() + 1, Color(0, 0, 0, 255));
-
-    ChunkResult result;
-
-    colormap::kbinani::Altitude colormap;
-    int const sZ = chunk->minBlockZ();
-    int const eZ = chunk->maxBlockZ();
-    int const sX = chunk->minBlockX();
-    int const eX = chunk->maxBlockX();
-    for (int z = sZ; z <= eZ; z++) {
-        for (int x = sX; x <= eX; x++) {
-            fill_n(translucentBlockPillar.begin(), translucentBlockPillar.size(), TranslucentBlock::Air());
-            int const maxY = SkyLevel(dimension, *chunk, x, z);
-            int const minY = chunk->minBlockY();
-            int pillarIndex = 0;
-            int pillarHeight = 0;
-            shared_ptr<Block const> opaqueBlock = nullptr;
-            
-            int elevation = 0;
-            int waterDepth = 0;
-            for (int y = maxY; y >= minY; y--, pillarIndex++) {
-                auto const& block = chunk->blockAt(x, y, z);
-                if (block) {
-                    if (IsWaterLike(*block)) {
-                        waterDepth++;
-                    }
-                    auto tb = TranslucentBlock::FromBlock(*block);
-                    if (tb.fA >= 1) {
-                        pillarHeight = pillarIndex;
-                        elevation = y;
-                        opaqueBlock = block;
-                        break;
-                    }
-                    translucentBlockPillar[pillarIndex] = tb;
-                } else {
-                    translucentBlockPillar[pillarIndex] = TranslucentBlock::Air();
-                }
-            }
-            Color opaqueBlockColor(0, 0, 0);
-            if (opaqueBlock) {
-                if (opaqueBlock->fName == kGrassBlock.fName) {
-                    float const v = Clamp((elevation - 63.0) / 193.0, 0.0, 1.0);
-                    auto mapped = colormap.getColor(v);
-                    opaqueBlockColor = Color::FromFloat(mapped.r, mapped.g, mapped.b, 1);
-                } else {
-                    auto color = BlockColor(*opaqueBlock);
-                    if (color) {
-                        opaqueBlockColor = *color;
-                    }
-                }
-            }
-            Color c = DiffuseBlockColor(opaqueBlockColor, waterDepth, translucentBlockPillar, pillarHeight);
-            int const idx = (z - minZ) * width + (x - minX);
-            result.pixels[idx] = c;
-            result.altitude[idx] = elevation;
-        }
+static char const* DimensionName(int dimension) {
+    switch (dimension) {
+        case mca2png::kNether:
+            return "nether";
+        case mca2png::kTheEnd:
+            return "end";
+        default:
+            return "overworld";
     }
-    
-    return result;
 }
 
-static void RegionToPng2(string world, int dimension, int regionX, int regionZ, string png, bool zopfli) {
-    int const width = 513;
-    int const height = 513;
-    
-    vector<Landmark> nearbyLandmarks;
-    if (!kLandmarks.empty()){
-        int const minBlockX = regionX * 512 - kVisibleRadius * 2;
-        int const maxBlockX = regionX * 512 + 511 + kVisibleRadius * 2;
-        
-        int const minBlockZ = regionZ * 512 - kVisibleRadius * 2;
-        int const maxBlockZ = regionZ * 512 + 511 + kVisibleRadius * 2;
-        for (auto it = kLandmarks.begin(); it != kLandmarks.end(); it++) {
-            if (dimension == it->dimension && minBlockX <= it->x && it->x <= maxBlockX && minBlockZ <= it->z && it->z <= maxBlockZ) {
-                nearbyLandmarks.push_back(*it);
-            }
-        }
-        if (nearbyLandmarks.empty()) {
-            return;
-        }
+// "o", "n", "e" か, ディメンションの番号 "0", "-1", "1".
+static bool ParseDimension(string const& s, int& dimension) {
+    if (s == "o" || s == "0") {
+        dimension = mca2png::kOverworld;
+    } else if (s == "n" || s == "-1") {
+        dimension = mca2png::kNether;
+    } else if (s == "e" || s == "1") {
+        dimension = mca2png::kTheEnd;
+    } else {
+        return false;
     }
-    
-    vector<uint8_t> altitude(width * height, 0);
-    vector<Color> pixels(width * height, Color::FromFloat(0, 0, 0, 1));
-
-    int const minX = regionX * 512 - 1;
-    int const minZ = regionZ * 512 - 1;
-        
-    deque<future<optional<ChunkResult>>> futures;
-    unsigned int concurrency = thread::hardware_concurrency();
-    hwm::task_queue pool(concurrency);
-    
-    for (int localChunkZ = 0; localChunkZ < 32; localChunkZ++) {
-        int const chunkZ = regionZ * 32 + localChunkZ;
-        for (int localChunkX = 0; localChunkX < 32; localChunkX++) {
-            int const chunkX = regionX * 32 + localChunkX;
-            futures.emplace_back(move(pool.enqueue(Render, world, dimension, chunkX, chunkZ, minX, minZ, width)));
-        }
-    }
-    while (!futures.empty()) {
-        auto result = futures.front().get();
-        futures.pop_front();
-        if (!result) {
-            continue;
-        }
-        for (auto it : result->altitude) {
-            altitude[it.first] = it.second;
+    return true;
+}
+
+// "all" か, "o", "n", "e" をカンマで区切ったもの.
+static bool ParseDimensions(char const* arg, vector<int>& dimensions) {
+    dimensions.clear();
+    string const s(arg);
+    if (s == "all") {
+        dimensions = {mca2png::kOverworld, mca2png::kNether, mca2png::kTheEnd};
+        return true;
+    }
+    istringstream ss(s);
+    string d;
+    while (getline(ss, d, ',')) {
+        int dimension;
+        if (!ParseDimension(d, dimension)) {
+            return false;
         }
-        for (auto it : result->pixels) {
-            pixels[it.first] = it.second;
+        if (find(dimensions.begin(), dimensions.end(), dimension) == dimensions.end()) {
+            dimensions.push_back(dimension);
         }
     }
+    return !dimensions.empty();
+}
 
-    // 北側のチャンクがまだ無い場合に備えて, 1 ブロック南の高度をデフォルト値に使う.
-    for (int x = minX + 1; x < minX + 512; x++) {
-        int const z = minZ;
-        int i1 = (z + 1 - minZ) * width + (x - minX);
-        int i0 = (z - minZ) * width + (x - minX);
-        altitude[i0] = altitude[i1];
+// "N=PATH". N は ParseDimension の形式.
+static bool ParseDimensionDirectory(char const* arg, map<int, fs::path>& directories) {
+    string const s(arg);
+    size_t const eq = s.find('=');
+    int dimension;
+    if (eq == string::npos || eq + 1 == s.size() || !ParseDimension(s.substr(0, eq), dimension)) {
+        return false;
     }
+    directories[dimension] = s.substr(eq + 1);
+    return true;
+}
 
-    // 西側のチャンクがまだ無い場合に備えて, 1 ブロック東の高度をデフォルト値に使う.
-    for (int z = minZ + 1; z < minZ + 512; z++) {
-        int const x = minX;
-        int i1 = (z - minZ) * width + (x + 1 - minX);
-        int i0 = (z - minZ) * width + (x - minX);
-        altitude[i0] = altitude[i1];
+// --dimension で指定されたものを優先し, 無ければバニラのワールドと同じ配置.
+// ネザーは DIM-1, ジ・エンドは DIM1 の下にある.
+static fs::path DimensionDirectory(fs::path const& world, int dimension, map<int, fs::path> const& overrides) {
+    if (auto found = overrides.find(dimension); found != overrides.end()) {
+        return found->second;
     }
+    switch (dimension) {
+        case mca2png::kNether:
+            return world / "DIM-1";
+        case mca2png::kTheEnd:
+            return world / "DIM1";
+        default:
+            return world;
+    }
+}
 
-    // 北側
-    for (int lcx = 0; lcx < 32; lcx++) {
-        int const chunkX = regionX * 32 + lcx;
-        int const chunkZ = (regionZ - 1) * 32 + 31;
-        fs::path chunkFilePath = fs::path(world) / "chunk" / Region::GetDefaultCompressedChunkNbtFileName(chunkX, chunkZ);
-        if (!fs::exists(chunkFilePath)) {
-            continue;
-        }
-        shared_ptr<Chunk> chunk = Chunk::LoadFromCompressedChunkNbtFile(chunkFilePath, chunkX, chunkZ);
-        int const z = chunk->maxBlockZ();
-        for (int lbx = 0; lbx < 16; lbx++) {
-            int const x = chunk->minBlockX() + lbx;
-            int const idx = (z - minZ) * width + (x - minX);
-            altitude[idx] = Altitude(dimension, *chunk, x, z);
-        }
-    }
-    
-    // 西側
-    for (int lcz = 0; lcz < 32; lcz++) {
-        int const chunkX = (regionX - 1) * 32 + 31;
-        int const chunkZ = regionZ * 32 + lcz;
-        fs::path chunkFilePath = fs::path(world) / "chunk" / Region::GetDefaultCompressedChunkNbtFileName(chunkX, chunkZ);
-        if (!fs::exists(chunkFilePath)) {
-            continue;
-        }
-        shared_ptr<Chunk> chunk = Chunk::LoadFromCompressedChunkNbtFile(chunkFilePath, chunkX, chunkZ);
-        int const x = chunk->maxBlockX();
-        for (int lbz = 0; lbz < 16; lbz++) {
-            int const z = chunk->minBlockZ() + lbz;
-            int const idx = (z - minZ) * width + (x - minX);
-            altitude[idx] = Altitude(dimension, *chunk, x, z);
-        }
-    }
-    
-    vector<uint32_t> img(512 * 512, Color(0, 0, 0, 0).color());
-    bool blackout = true;
-
-    for (int z = 1; z < height; z++) {
-        int const blockZ = regionZ * 512 + z - 1;
-        for (int x = 1; x < width; x++) {
-            int const blockX = regionX * 512 + x - 1;
-            int const idx = z * width + x;
-            uint8_t const h = altitude[idx];
-            Color c = pixels[idx];
-            Color color = c;
-
-            uint8_t hNorth = altitude[(z - 1) * width + x];
-            uint8_t hWest = altitude[z * width + x - 1];
-            int score = 0; // +: bright, -: dark
-            if (hNorth > h) score--;
-            if (hNorth < h) score++;
-            if (hWest > h) score--;
-            if (hWest < h) score++;
-
-            float minDistance = numeric_limits<float>::max();
-            float brightness = 1;
-            if (!kLandmarks.empty()) {
-                for (int j = 0; j < nearbyLandmarks.size(); j++) {
-                    Landmark const& landmark = nearbyLandmarks[j];
-                    float const distance = hypotf(blockX - landmark.x, blockZ - landmark.z);
-                    minDistance = min(minDistance, distance);
-                }
-                brightness = BrightnessByDistanceFromLandmark(minDistance);
-            }
-
-            if (score > 0) {
-                float coeff = 1.2;
-                HSV hsv = color.toHSV();
-                hsv.fV = hsv.fV * coeff * brightness;
-                Color cc = Color::FromHSV(hsv);
-                color = cc;
-            } else if (score < 0) {
-                float coeff = 0.8;
-                HSV hsv = color.toHSV();
-                hsv.fV = hsv.fV * coeff * brightness;
-                Color cc = Color::FromHSV(hsv);
-                color = cc;
-            } else {
-                HSV hsv = color.toHSV();
-                hsv.fV = hsv.fV * brightness;
-                color = Color::FromHSV(hsv);
-            }
-            
-            if (brightness > 0) {
-                blackout = false;
-            }
-            int i = (z - 1) * 512 + (x - 1);
-            img[i] = Color::FromFloat(color.fR, color.fG, color.fB, color.fA * brightness).color();
+// "1/N" か "N". N は 1, 2, 4, 8 のいずれか.
+static bool ParseScale(char const* arg, int& scale) {
+    int consumed = 0;
+    if (sscanf(arg, "1/%d%n", &scale, &consumed) != 1 || arg[consumed] != '\0') {
+        consumed = 0;
+        if (sscanf(arg, "%d%n", &scale, &consumed) != 1 || arg[consumed] != '\0') {
+            return false;
         }
     }
+    return scale == 1 || scale == 2 || scale == 4 || scale == 8;
+}
 
-    if (blackout) {
-        return;
+// "x0,z0,x1,z1". 端はどちらの順に書いてもよい.
+// 辺が mca2png::World::kMaxAreaSize を超える矩形は受け付けない.
+static bool ParseBoundingBox(char const* arg, array<int, 4>& box) {
+    int x0, z0, x1, z1, consumed = 0;
+    if (sscanf(arg, "%d,%d,%d,%d%n", &x0, &z0, &x1, &z1, &consumed) != 4 || arg[consumed] != '\0') {
+        return false;
     }
+    box = {min(x0, x1), min(z0, z1), max(x0, x1), max(z0, z1)};
+    int64_t const width = (int64_t)box[2] - box[0] + 1;
+    int64_t const height = (int64_t)box[3] - box[1] + 1;
+    if (width > mca2png::World::kMaxAreaSize || height > mca2png::World::kMaxAreaSize) {
+        cerr << "--bbox: at most " << mca2png::World::kMaxAreaSize << " blocks per side" << endl;
+        return false;
+    }
+    return true;
+}
 
-    vector<unsigned char> in;
-    copy_n((unsigned char*)img.data(), img.size() * sizeof(uint32_t), back_inserter(in));
-    vector<uint32_t>().swap(img);
-    
-    vector<unsigned char> out;
-    if (lodepng::encode(out, in, 512, 512) != 0) {
-        return;
+// "N" か "N0:N1". 後ろに余計な文字があるものは受け付けない.
+static bool ParseRange(char const* arg, int& min, int& max) {
+    int consumed = 0;
+    if (sscanf(arg, "%d:%d%n", &min, &max, &consumed) == 2 && arg[consumed] == '\0') {
+        return min <= max;
+    }
+    consumed = 0;
+    if (sscanf(arg, "%d%n", &min, &consumed) == 1 && arg[consumed] == '\0') {
+        max = min;
+        return true;
     }
+    return false;
+}
 
-    if (zopfli) {
-        vector<unsigned char> result;
-        ZopfliPNGOptions opt;
-        opt.verbose = false;
-        if (ZopfliPNGOptimize(out, opt, false, &result) != 0) {
-            return;
-        }
-        out.swap(result);
+// 単位を省略した場合は MiB.
+static bool ParseMemorySize(char const* arg, uint64_t& bytes) {
+    double value;
+    char unit = 'M';
+    int const n = sscanf(arg, "%lf%c", &value, &unit);
+    if (n < 1 || value < 0) {
+        return false;
     }
-    
-    FILE* file = fopen(png.c_str(), "wb");
-    if (!file) {
-        return;
+    switch (toupper(unit)) {
+        case 'K':
+            bytes = (uint64_t)(value * 1024);
+            return true;
+        case 'M':
+            bytes = (uint64_t)(value * 1024 * 1024);
+            return true;
+        case 'G':
+            bytes = (uint64_t)(value * 1024 * 1024 * 1024);
+            return true;
+        default:
+            return false;
     }
-    fwrite(out.data(), 1, out.size(), file);
-    fclose(file);
 }
 
-static void PrintDescription() {
-    cerr << "mca2png -w [world directory] -x [region x] -z [region z] -o [output directory] -l [path to 'landmarks.tsv'] -d [dimension; o:overworld, n:nether, e:theEnd] [-m(minify png with zopfli)]" << endl;
+enum : int {
+    kOptionMaxMemory = 256,
+    kOptionMaxChunks,
+    kOptionMaxRegions,
+    kOptionListRegions,
+    kOptionParallelEncode,
+    kOptionWatch,
+    kOptionServe,
+    kOptionCacheSize,
+    kOptionBoundingBox,
+    kOptionScale,
+    kOptionProgressive,
+    kOptionLayers,
+    kOptionFormat,
+    kOptionSaveColumns,
+    kOptionReshade,
+    kOptionDimension,
+};
+
+// --watch と --serve は SIGINT と SIGTERM で止めて, 集計を出してから終わる. 2 回目は既定の動作に戻す.
+static atomic<ChunkWatcher*> sStopWatcher(nullptr);
+static atomic<TileServer*> sStopServer(nullptr);
+
+static void StopOnSignal(int) {
+    if (TileServer* server = sStopServer.load()) {
+        server->stop();
+    } else if (ChunkWatcher* watcher = sStopWatcher.load()) {
+        watcher->stop();
+    }
+}
+
+static void InstallStopHandler() {
+    struct sigaction action{};
+    action.sa_handler = StopOnSignal;
+    action.sa_flags = SA_RESETHAND | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
 }
 
 int main(int argc, char *argv[]) {
     string input;
     string output;
     string landmarksFile;
-    int dimension = 100;
-    int x = INT_MAX;
-    int z = INT_MAX;
+    vector<int> dimensions;
+    // --dimension で指定されたディメンション毎のディレクトリ
+    map<int, fs::path> dimensionOverrides;
+    int minRegionX = INT_MAX;
+    int maxRegionX = INT_MAX;
+    int minRegionZ = INT_MAX;
+    int maxRegionZ = INT_MAX;
     bool zopfli = false;
+    bool raw = false;
+    bool saveColumns = false;
+    bool reshade = false;
+    bool perf = false;
+    double progressInterval = 0;
+    string errorLogFile;
+    uint64_t maxMemory = 0;
+    int maxChunks = 0;
+    int maxRegions = 2;
+    bool listRegions = false;
+    bool parallelEncode = false;
+    bool watch = false;
+    int servePort = 0;
+    uint64_t cacheSize = 256 * 1024 * 1024;
+    optional<array<int, 4>> bbox;
+    int scale = 1;
+    bool progressive = false;
+    vector<unique_ptr<LayerWriter>> layerWriters;
+
+    static option const kLongOptions[] = {
+        {"max-memory", required_argument, nullptr, kOptionMaxMemory},
+        {"max-chunks", required_argument, nullptr, kOptionMaxChunks},
+        {"max-regions", required_argument, nullptr, kOptionMaxRegions},
+        {"list-regions", no_argument, nullptr, kOptionListRegions},
+        {"parallel-encode", no_argument, nullptr, kOptionParallelEncode},
+        {"watch", no_argument, nullptr, kOptionWatch},
+        {"serve", required_argument, nullptr, kOptionServe},
+        {"cache-size", required_argument, nullptr, kOptionCacheSize},
+        {"bbox", required_argument, nullptr, kOptionBoundingBox},
+        {"scale", required_argument, nullptr, kOptionScale},
+        {"progressive", no_argument, nullptr, kOptionProgressive},
+        {"layers", required_argument, nullptr, kOptionLayers},
+        {"format", required_argument, nullptr, kOptionFormat},
+        {"save-columns", no_argument, nullptr, kOptionSaveColumns},
+        {"reshade", no_argument, nullptr, kOptionReshade},
+        {"dimension", required_argument, nullptr, kOptionDimension},
+        {nullptr, 0, nullptr, 0},
+    };
 
     int opt;
     opterr = 0;
-    while ((opt = getopt(argc, argv, "w:x:z:o:l:d:m")) != -1) {
+    while ((opt = getopt_long(argc, argv, "w:x:z:o:l:d:mpi:e:", kLongOptions, nullptr)) != -1) {
         switch (opt) {
             case 'w':
                 input = optarg;
@@ -511,28 +459,20 @@ int main(int argc, char *argv[]) {
             case 'l':
                 landmarksFile = optarg;
                 break;
-            case 'd': {
-                string d(optarg);
-                if (d == "o") {
-                    dimension = 0;
-                } else if (d == "n") {
-                    dimension = -1;
-                } else if (d == "e") {
-                    dimension = 1;
-                } else {
+            case 'd':
+                if (!ParseDimensions(optarg, dimensions)) {
                     PrintDescription();
                     return 1;
                 }
                 break;
-            }
             case 'x':
-                if (sscanf(optarg, "%d", &x) != 1) {
+                if (!ParseRange(optarg, minRegionX, maxRegionX)) {
                     PrintDescription();
                     return 1;
                 }
                 break;
             case 'z':
-                if (sscanf(optarg, "%d", &z) != 1) {
+                if (!ParseRange(optarg, minRegionZ, maxRegionZ)) {
                     PrintDescription();
                     return 1;
                 }
@@ -540,17 +480,133 @@ int main(int argc, char *argv[]) {
             case 'm':
                 zopfli = true;
                 break;
+            case 'p':
+                perf = true;
+                break;
+            case 'i':
+                if (sscanf(optarg, "%lf", &progressInterval) != 1) {
+                    PrintDescription();
+                    return 1;
+                }
+                break;
+            case 'e':
+                errorLogFile = optarg;
+                break;
+            case kOptionMaxMemory:
+                if (!ParseMemorySize(optarg, maxMemory)) {
+                    PrintDescription();
+                    return 1;
+                }
+                break;
+            case kOptionMaxChunks:
+                if (sscanf(optarg, "%d", &maxChunks) != 1 || maxChunks < 1) {
+                    PrintDescription();
+                    return 1;
+                }
+                break;
+            case kOptionMaxRegions:
+                if (sscanf(optarg, "%d", &maxRegions) != 1 || maxRegions < 1) {
+                    PrintDescription();
+                    return 1;
+                }
+                break;
+            case kOptionListRegions:
+                listRegions = true;
+                break;
+            case kOptionParallelEncode:
+                parallelEncode = true;
+                break;
+            case kOptionWatch:
+                watch = true;
+                break;
+            case kOptionServe:
+                if (sscanf(optarg, "%d", &servePort) != 1 || servePort < 1 || 65535 < servePort) {
+                    PrintDescription();
+                    return 1;
+                }
+                break;
+            case kOptionCacheSize:
+                if (!ParseMemorySize(optarg, cacheSize)) {
+                    PrintDescription();
+                    return 1;
+                }
+                break;
+            case kOptionScale:
+                if (!ParseScale(optarg, scale)) {
+                    PrintDescription();
+                    return 1;
+                }
+                break;
+            case kOptionProgressive:
+                progressive = true;
+                break;
+            case kOptionFormat:
+                if (string(optarg) == "raw") {
+                    raw = true;
+                } else if (string(optarg) == "png") {
+                    raw = false;
+                } else {
+                    PrintDescription();
+                    return 1;
+                }
+                break;
+            case kOptionSaveColumns:
+                saveColumns = true;
+                break;
+            case kOptionReshade:
+                reshade = true;
+                break;
+            case kOptionDimension:
+                if (!ParseDimensionDirectory(optarg, dimensionOverrides)) {
+                    PrintDescription();
+                    return 1;
+                }
+                break;
+            case kOptionLayers: {
+                layerWriters.clear();
+                set<string> names;
+                istringstream list(optarg);
+                string name;
+                while (getline(list, name, ',')) {
+                    auto writer = MakeLayerWriter(name);
+                    if (!writer) {
+                        PrintDescription();
+                        return 1;
+                    }
+                    if (names.insert(name).second) {
+                        layerWriters.push_back(move(writer));
+                    }
+                }
+                break;
+            }
+            case kOptionBoundingBox:
+                if (array<int, 4> box; ParseBoundingBox(optarg, box)) {
+                    bbox = box;
+                } else {
+                    PrintDescription();
+                    return 1;
+                }
+                break;
             default:
                 PrintDescription();
                 return 1;
         }
     }
 
-    if (input.empty() || output.empty() || x == INT_MAX || z == INT_MAX || dimension == 100) {
+    if ((input.empty() && dimensionOverrides.empty()) || (minRegionX == INT_MAX) != (minRegionZ == INT_MAX)) {
         PrintDescription();
         return 1;
     }
-    
+
+#if defined(MCA2PNG_ALLOC_PROFILE)
+    // 確保の回数はプロセス全体で数えるので, リージョン毎の値にするには 1 つずつ描く.
+    if (maxRegions != 1) {
+        cerr << "allocation profiling: rendering one region at a time (--max-regions 1)" << endl;
+        maxRegions = 1;
+    }
+#endif
+
+    vector<mca2png::Landmark> landmarks;
     {
         ifstream stream(landmarksFile.c_str());
         string line;
@@ -559,14 +615,436 @@ int main(int argc, char *argv[]) {
             if (sscanf(line.c_str(), "%d\t%d\t%d", &dim, &x, &z) != 3) {
                 continue;
             }
-            kLandmarks.push_back({.dimension = dim, .x = x, .z = z});
+            landmarks.push_back({.dimension = dim, .x = x, .z = z});
+        }
+    }
+
+    // 1 つだけの場合は今まで通り -w のチャンクを読み, -o に書き出す.
+    bool const multipleDimensions = dimensions.size() > 1;
+    map<int, fs::path> dimensionDirectories;
+    if (!multipleDimensions) {
+        int const d = dimensions.empty() ? mca2png::kOverworld : dimensions[0];
+        auto found = dimensionOverrides.find(d);
+        if (found == dimensionOverrides.end() && input.empty()) {
+            cerr << "no directory for " << DimensionName(d) << ": give -w or --dimension" << endl;
+            return 1;
+        }
+        dimensionDirectories[d] = found != dimensionOverrides.end() ? found->second : fs::path(input);
+    } else {
+        for (int d : dimensions) {
+            if (input.empty() && dimensionOverrides.find(d) == dimensionOverrides.end()) {
+                cerr << "skipping " << DimensionName(d) << ": no -w or --dimension for it" << endl;
+                continue;
+            }
+            fs::path const directory = DimensionDirectory(input, d, dimensionOverrides);
+            if (!fs::is_directory(directory / "chunk")) {
+                cerr << "skipping " << DimensionName(d) << ": no chunk directory in " << directory.string() << endl;
+                continue;
+            }
+            dimensionDirectories[d] = directory;
+        }
+    }
+
+    Progress progress(0, errorLogFile);
+    mca2png::World::Options worldOptions;
+    worldOptions.maxMemory = maxMemory;
+    worldOptions.maxChunksInFlight = maxChunks;
+    worldOptions.landmarks = move(landmarks);
+    worldOptions.progress = &progress;
+    fs::path failed;
+    auto world = mca2png::World::Open(dimensionDirectories, move(worldOptions), &failed);
+    if (!world) {
+        cerr << "cannot read chunk directory: " << failed.string() << endl;
+        return 1;
+    }
+    // 描画用のプールは World の中にあるので, 並列エンコード用には別に持つ.
+    unique_ptr<hwm::task_queue> encodePool;
+    if (parallelEncode) {
+        encodePool = make_unique<hwm::task_queue>(max(thread::hardware_concurrency(), 1u));
+    }
+    if (listRegions) {
+        for (auto const& it : dimensionDirectories) {
+            for (auto const& r : world->regions(it.first)) {
+                if (multipleDimensions) {
+                    cout << DimensionName(it.first) << "\t";
+                }
+                cout << r.first << "\t" << r.second << "\t" << world->chunks(it.first, r.first, r.second) << endl;
+            }
+        }
+        return 0;
+    }
+
+    if ((output.empty() && servePort == 0) || dimensions.empty()) {
+        PrintDescription();
+        return 1;
+    }
+    if (multipleDimensions && (servePort != 0 || watch || bbox)) {
+        cerr << "--serve, --watch and --bbox take a single dimension" << endl;
+        return 1;
+    }
+    int const dimension = dimensions[0];
+    // --progressive では scale の縮小画像を先に書き, 最終的には等倍にする.
+    int const previewScale = progressive ? scale : 1;
+    int const finalScale = progressive ? 1 : scale;
+    if (progressive && scale == 1) {
+        PrintDescription();
+        return 1;
+    }
+    if ((bbox && scale != 1) || (servePort != 0 && progressive)) {
+        cerr << "--bbox takes no --scale, and --serve takes no --progressive" << endl;
+        return 1;
+    }
+    if ((bbox || servePort != 0) && (!layerWriters.empty() || saveColumns)) {
+        cerr << "--bbox and --serve take no --layers or --save-columns" << endl;
+        return 1;
+    }
+    if (reshade && (bbox || servePort != 0 || watch || scale != 1 || progressive || !layerWriters.empty() || saveColumns)) {
+        cerr << "--reshade takes no --bbox, --serve, --watch, --scale, --progressive, --layers or --save-columns" << endl;
+        return 1;
+    }
+    if (servePort != 0 && raw) {
+        cerr << "--serve only serves png" << endl;
+        return 1;
+    }
+    char const* const extension = raw ? ".raw" : ".png";
+
+    if (bbox) {
+        // 矩形 1 つを描画するだけなので, リージョンの一覧も監視も使わない.
+        auto const [minX, minZ, maxX, maxZ] = *bbox;
+        int const width = maxX - minX + 1;
+        int const height = maxZ - minZ + 1;
+        fs::path png(output);
+        if (png.extension() != extension) {
+            ostringstream name;
+            name << "area." << minX << "." << minZ << "." << maxX << "." << maxZ << extension;
+            png /= name.str();
+        }
+        PerfCounters::SetEnabled(perf);
+        progress.addRegions(1);
+        auto const started = chrono::steady_clock::now();
+        vector<uint32_t> img((size_t)width * height);
+        vector<int16_t> altitude(raw ? (size_t)width * height : 0);
+        vector<unsigned char> out;
+        bool rendered = world->renderArea(dimension, minX, minZ, maxX, maxZ, img.data(), raw ? altitude.data() : nullptr);
+        if (rendered && raw) {
+            EncodeRawRaster(img.data(), altitude.data(), width, height, minX, minZ, 1, out);
+        } else if (rendered) {
+            rendered = EncodeImage(img, width, height, EncodeOptions{zopfli, parallelEncode, false, encodePool.get()}, minX >> 9, minZ >> 9, progress, out);
+        }
+        if (rendered) {
+            if (string error; !WriteFileAtomically(png.string(), out.data(), out.size(), error)) {
+                progress.error(minX >> 9, minZ >> 9, "write", error);
+            }
+        }
+        progress.regionDone(chrono::steady_clock::now() - started);
+        PerfCounters::Report(cerr);
+        return progress.errors() > 0 ? 1 : 0;
+    }
+
+    // 初回の描画中の変更も取りこぼさないように, 先に監視を始めておく.
+    // サーバーとして動く場合は, 監視できなくても変更が反映されないだけなので続ける.
+    unique_ptr<ChunkWatcher> watcher;
+    if (watch || servePort != 0) {
+        // --serve と --watch ではディメンションは 1 つだけ.
+        fs::path const watched = dimensionDirectories.begin()->second;
+        watcher = ChunkWatcher::Open(watched);
+        if (!watcher) {
+            cerr << "cannot watch chunk directory: " << (watched / "chunk").string() << endl;
+            if (servePort == 0) {
+                return 1;
+            }
+        }
+    }
+
+    PerfCounters::SetEnabled(perf);
+
+    map<int, fs::path> outputDirectories;
+    for (auto const& it : dimensionDirectories) {
+        fs::path directory(output);
+        if (multipleDimensions && !output.empty()) {
+            directory /= DimensionName(it.first);
+            error_code ec;
+            fs::create_directories(directory, ec);
+            if (ec) {
+                cerr << "cannot create output directory: " << directory.string() << ": " << ec.message() << endl;
+                return 1;
+            }
+        }
+        outputDirectories[it.first] = directory;
+    }
+
+    auto outputPath = [&](int d, int x, int z) {
+        ostringstream name;
+        name << "r." << x << "." << z << extension;
+        return outputDirectories.at(d) / name.str();
+    };
+
+    // 全ディメンションのリージョンを, 重いものから順に描画する (LPT). 重さはチャンクファイルの
+    // 合計サイズで見積もる. ほとんど空のジ・エンドのリージョンは最後に回り, ネザーの重い
+    // リージョンの後に空いたドライバーを埋める.
+    struct RegionJob {
+        int dimension;
+        int x;
+        int z;
+        uint64_t cost;
+        int scale;
+        bool preview;
+    };
+    vector<RegionJob> regions;
+    for (auto const& it : dimensionDirectories) {
+        int const d = it.first;
+        vector<pair<int, int>> candidates;
+        if (minRegionX == INT_MAX) {
+            candidates = world->regions(d);
+        } else {
+            for (int z = minRegionZ; z <= maxRegionZ; z++) {
+                for (int x = minRegionX; x <= maxRegionX; x++) {
+                    candidates.push_back(make_pair(x, z));
+                }
+            }
+        }
+        if (reshade) {
+            // 前回の走査結果が残っている全てのリージョン. ランドマークから外れて真っ暗になったものも,
+            // 古い画像を消すために回る.
+            for (auto const& r : ColumnsRegions(outputDirectories.at(d))) {
+                bool const inRange = minRegionX == INT_MAX || (minRegionX <= r.first && r.first <= maxRegionX && minRegionZ <= r.second && r.second <= maxRegionZ);
+                if (inRange) {
+                    regions.push_back({d, r.first, r.second, 0, finalScale, false});
+                }
+            }
+            continue;
+        }
+        for (auto const& r : candidates) {
+            // 走査結果を残す場合は, 今は真っ暗なリージョンも走査しておく.
+            if (world->hasRegion(d, r.first, r.second) && (world->visible(d, r.first, r.second) || saveColumns)) {
+                regions.push_back({d, r.first, r.second, world->compressedBytes(d, r.first, r.second), finalScale, false});
+            }
+        }
+    }
+    stable_sort(regions.begin(), regions.end(), [](RegionJob const& a, RegionJob const& b) {
+        return a.cost > b.cost;
+    });
+    if (progressive) {
+        // 全リージョンの縮小画像を書いてから, 同じ順に等倍で描き直す. 既に画像のあるリージョンは
+        // チャンクを読む前に縮小画像の対象から外す.
+        vector<RegionJob> previews;
+        for (auto const& job : regions) {
+            if (!fs::exists(outputPath(job.dimension, job.x, job.z))) {
+                previews.push_back({job.dimension, job.x, job.z, job.cost, previewScale, true});
+            }
+        }
+        regions.insert(regions.begin(), previews.begin(), previews.end());
+    }
+
+    EncodeOptions const encodeOptions = {zopfli, parallelEncode, raw, encodePool.get()};
+
+    if (servePort != 0) {
+        progress.start(progressInterval);
+        // 初回の描画はせず, リクエストされたタイルだけを描画する.
+        TileServer server([&](int x, int z) -> TileServer::Rendered {
+            if (!world->hasRegion(dimension, x, z)) {
+                return TileServer::Rendered{nullptr, true};
+            }
+            progress.addRegions(1);
+            auto const started = chrono::steady_clock::now();
+            int const size = mca2png::kRegionSize / finalScale;
+            vector<uint32_t> img(size * size);
+            auto out = make_shared<vector<unsigned char>>();
+            // チャンクの読み込みの失敗は progress に報告されるだけなので, エラーの数で調べる.
+            // 他のタイルのエラーが混ざっても, キャッシュしないだけで済む.
+            int const errors = progress.errors();
+            bool const rendered = world->renderRegion(dimension, x, z, img.data(), nullptr, finalScale);
+            bool const encoded = rendered && EncodeImage(img, size, size, encodeOptions, x, z, progress, *out);
+            progress.regionDone(chrono::steady_clock::now() - started);
+            // 描画するものが無い・真っ暗なものは 404 としてキャッシュする.
+            return TileServer::Rendered{encoded ? out : nullptr, progress.errors() == errors};
+        }, cacheSize);
+        string error;
+        if (!server.listen((uint16_t)servePort, error)) {
+            cerr << "cannot listen on 127.0.0.1:" << servePort << ": " << error << endl;
+            return 1;
+        }
+        thread watchThread;
+        if (watcher) {
+            watchThread = thread([&]() {
+                while (true) {
+                    ChunkChanges changes;
+                    if (string error; !watcher->wait(chrono::seconds(2), chrono::seconds(30), changes, error)) {
+                        // 描画済みのタイルは配信し続ける.
+                        if (!error.empty()) {
+                            cerr << "stopped watching chunk directory: " << error << endl;
+                        }
+                        return;
+                    }
+                    set<pair<int, int>> direct;
+                    set<pair<int, int>> border;
+                    world->applyChanges(dimension, changes, direct, border);
+                    if (changes.overflow) {
+                        server.invalidateAll();
+                    }
+                    for (auto const& r : direct) {
+                        server.invalidate(r.first, r.second);
+                    }
+                    for (auto const& r : border) {
+                        server.invalidate(r.first, r.second);
+                    }
+                }
+            });
+        }
+        cerr << "serving tiles on http://127.0.0.1:" << servePort << "/" << endl;
+        sStopServer = &server;
+        InstallStopHandler();
+        bool const stopped = server.run();
+        sStopServer = nullptr;
+        if (!stopped) {
+            cerr << "cannot accept connections" << endl;
+        }
+        // server, world, watcher を破棄する前に止める.
+        if (watchThread.joinable()) {
+            watcher->stop();
+            watchThread.join();
+        }
+        progress.stop();
+        PerfCounters::Report(cerr);
+        return stopped ? 0 : 1;
+    }
+
+    progress.addRegions((int)regions.size());
+    progress.start(progressInterval);
+
+    // I/O は専用スレッドで行い, 各ドライバーが次に担当しそうなリージョンを先読みしておく.
+    int const driverCount = min(maxRegions, (int)regions.size());
+    mutex fetchMutex;
+    map<size_t, future<vector<ChunkBuffer>>> fetches;
+    // --reshade ではチャンクを読まない.
+    auto prefetch = [&](size_t i) {
+        if (i >= regions.size() || reshade) {
+            return;
+        }
+        lock_guard<mutex> lock(fetchMutex);
+        if (fetches.find(i) == fetches.end()) {
+            fetches[i] = world->fetch(regions[i].dimension, regions[i].x, regions[i].z);
+        }
+    };
+    for (int i = 0; i < driverCount; i++) {
+        prefetch(i);
+    }
+
+    auto renderRegion = [&](int d, int x, int z, int scale, bool preview, vector<ChunkBuffer> buffers) {
+        fs::path const png = outputPath(d, x, z);
+
+        AllocProfiler::BeginRegion();
+        auto const started = chrono::steady_clock::now();
+        RegionToPng2(*world, d, x, z, scale, preview, move(buffers), png.string(), encodeOptions, layerWriters, saveColumns, progress);
+        progress.regionDone(chrono::steady_clock::now() - started);
+        AllocProfiler::Report(cerr, x, z);
+    };
+
+    atomic<size_t> nextRegion(0);
+    auto driver = [&]() {
+        while (true) {
+            size_t const i = nextRegion.fetch_add(1);
+            if (i >= regions.size()) {
+                break;
+            }
+            if (reshade) {
+                auto const started = chrono::steady_clock::now();
+                ReshadeRegion(*world, regions[i].dimension, regions[i].x, regions[i].z, outputPath(regions[i].dimension, regions[i].x, regions[i].z).string(), encodeOptions, progress);
+                progress.regionDone(chrono::steady_clock::now() - started);
+                continue;
+            }
+            prefetch(i);
+            prefetch(i + driverCount);
+            future<vector<ChunkBuffer>> fetched;
+            {
+                lock_guard<mutex> lock(fetchMutex);
+                fetched = move(fetches[i]);
+                fetches.erase(i);
+            }
+            renderRegion(regions[i].dimension, regions[i].x, regions[i].z, regions[i].scale, regions[i].preview, fetched.get());
         }
+    };
+    vector<thread> drivers;
+    for (int i = 0; i < driverCount; i++) {
+        drivers.emplace_back(driver);
+    }
+    for (auto& d : drivers) {
+        d.join();
+    }
+
+    // 番号と名前の対応表は全てのディメンションで共通なので, 各出力先に同じものを書く.
+    auto writeLegends = [&]() {
+        for (auto const& writer : layerWriters) {
+            for (auto const& it : outputDirectories) {
+                if (string error; !writer->writeLegend(*world, it.second, error)) {
+                    cerr << "cannot write legend: " << error << endl;
+                }
+            }
+        }
+    };
+    writeLegends();
+
+    if (watcher) {
+        // 以降は変更されたチャンクに関係するリージョンだけを, 終了させられるまで描画し続ける.
+        RegionQueue queue;
+        vector<thread> workers;
+        for (int i = 0; i < maxRegions; i++) {
+            workers.emplace_back([&]() {
+                pair<int, int> region;
+                while (queue.pop(region)) {
+                    renderRegion(dimension, region.first, region.second, finalScale, false, world->fetch(dimension, region.first, region.second).get());
+                    queue.done(region);
+                }
+            });
+        }
+        sStopWatcher = watcher.get();
+        InstallStopHandler();
+        bool stopped = false;
+        while (true) {
+            ChunkChanges changes;
+            if (string error; !watcher->wait(chrono::seconds(2), chrono::seconds(30), changes, error)) {
+                // シグナルで止めた場合は error が空.
+                stopped = error.empty();
+                if (!stopped) {
+                    cerr << "stopped watching chunk directory: " << error << endl;
+                }
+                break;
+            }
+            // 前回までに描き直したリージョンで増えた名前を載せる.
+            writeLegends();
+            set<pair<int, int>> direct;
+            set<pair<int, int>> border;
+            world->applyChanges(dimension, changes, direct, border);
+            auto const unrenderable = [&](pair<int, int> const& r) {
+                return !world->hasRegion(dimension, r.first, r.second) || !world->visible(dimension, r.first, r.second);
+            };
+            erase_if(direct, unrenderable);
+            erase_if(border, unrenderable);
+            int added = 0;
+            for (auto const& r : direct) {
+                added += queue.push(r, true) ? 1 : 0;
+            }
+            for (auto const& r : border) {
+                added += queue.push(r, false) ? 1 : 0;
+            }
+            progress.addRegions(added);
+        }
+        // 待っているリージョンは描かずに終わる.
+        queue.close();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        sStopWatcher = nullptr;
+        progress.stop();
+        PerfCounters::Report(cerr);
+        if (stopped) {
+            return progress.errors() > 0 ? 1 : 0;
+        }
+        return 1;
     }
 
-    ostringstream name;
-    name << "r." << x << "." << z << ".png";
-    fs::path png = fs::path(output).append(name.str());
-    RegionToPng2(input, dimension, x, z, png.string(), zopfli);
+    progress.stop();
+    PerfCounters::Report(cerr);
 
-    return 0;
+    return progress.errors() > 0 ? 1 : 0;
 }
@@ -0,0 +1,1361 @@
+#include "mca2png.h"
+
+#include <hwm/task/task_queue.hpp>
+
+#include "minecraft-file.hpp"
+#include "chunk_io.h"
+#include "memory_budget.h"
+#include "name_table.h"
+#include "progress.h"
+#include "world_index.h"
+#include "block_color.h"
+#include "block_states.h"
+#include "rgba8.h"
+#include "color_tables.h"
+#include "perf_counters.h"
+#include "alloc_profiler.h"
+#include "mpsc_queue.h"
+
+#include <math.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <set>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+using namespace std;
+using namespace mcfile;
+using namespace mcfile::je;
+namespace fs = std::filesystem;
+using mca2png::Landmark;
+
+static int const kVisibleRadius = ColorTables::kVisibleRadius;
+
+// 列の走査や陰影付けはディメンションや描画オプションをテンプレート引数にして,
+// ループの中に不変な分岐が残らないようにする. 特殊化はリージョン毎に一度だけ選ぶ.
+// チャンク内の列 (z * 16 + x) の集合.
+using ColumnMask = bitset<16 * 16>;
+
+template<int Dimension, class Blocks>
+static void SkyLevels(Blocks const& chunk, ColumnMask const& columns, array<int, 16 * 16>& sky) {
+    if constexpr (Dimension != -1) {
+        sky.fill(chunk.maxBlockY());
+    } else {
+        sky.fill(0);
+        ColumnMask pending = columns;
+        for (int y = 127; y >= 0 && pending.any(); y--) {
+            for (int idx = 0; idx < 16 * 16; idx++) {
+                if (!pending[idx]) {
+                    continue;
+                }
+                auto block = chunk.blockIdAt(chunk.minBlockX() + idx % 16, y, chunk.minBlockZ() + idx / 16);
+                if (block == mcfile::blocks::minecraft::air) {
+                    sky[idx] = y;
+                    pending.reset(idx);
+                }
+            }
+        }
+    }
+}
+
+static bool IsTrapdoor(Block const& block) {
+    return block.fName.ends_with("_trapdoor");
+}
+
+// 走査中のブロックと, それが水に満たされているか. ChunkBlocks ではパレットの要素毎に
+// 判定済みの値を引くので, 列の走査の中で名前や状態を調べることはない.
+static Block const* ColumnBlockAt(ChunkBlocks const& chunk, int x, int y, int z, bool& waterLike) {
+    return chunk.blockAt(x, y, z, waterLike);
+}
+
+static Block const* ColumnBlockAt(Chunk const& chunk, int x, int y, int z, bool& waterLike) {
+    auto const& block = chunk.blockAt(x, y, z);
+    waterLike = block && IsWaterLikeBlock(*block);
+    return block.get();
+}
+
+class TranslucentBlock {
+private:
+    TranslucentBlock() = delete;
+    
+public:
+    static Rgba8 Air() {
+        return Rgba8::Make(0, 0, 0, 0);
+    }
+    
+    static Rgba8 Opaque() {
+        return Rgba8::Make(0, 0, 0, 255);
+    }
+    
+    // waterLike は IsWaterLikeBlock(block) の結果.
+    static Rgba8 FromBlock(Block const& block, bool waterLike) {
+        if (waterLike) {
+            return Rgba8::Make(69, 91, 211, 0);
+        }
+        blocks::BlockId blockId = block.fId;
+        int const stainedGlassAlpha = (int)(255 * 0.5);
+        switch (blockId) {
+            case blocks::minecraft::air:
+            case blocks::minecraft::cave_air:
+                return Air();
+            case blocks::minecraft::glass:
+            case blocks::minecraft::glass_pane:
+                return Rgba8::Make(255, 255, 255, 4);
+            case blocks::minecraft::white_stained_glass:
+            case blocks::minecraft::white_stained_glass_pane:
+                return Rgba8::Make(255, 255, 255, stainedGlassAlpha);
+            case blocks::minecraft::orange_stained_glass:
+            case blocks::minecraft::orange_stained_glass_pane:
+                return Rgba8::Make(255, 165, 0, stainedGlassAlpha);
+            case blocks::minecraft::magenta_stained_glass:
+            case blocks::minecraft::magenta_stained_glass_pane:
+                return Rgba8::Make(255, 0, 255, stainedGlassAlpha);
+            case blocks::minecraft::light_blue_stained_glass:
+            case blocks::minecraft::light_blue_stained_glass_pane:
+                return Rgba8::Make(142, 209, 224, stainedGlassAlpha);
+            case blocks::minecraft::yellow_stained_glass:
+            case blocks::minecraft::yellow_stained_glass_pane:
+                return Rgba8::Make(227, 199, 0, stainedGlassAlpha);
+            case blocks::minecraft::lime_stained_glass:
+            case blocks::minecraft::lime_stained_glass_pane:
+                return Rgba8::Make(0, 255, 0, stainedGlassAlpha);
+            case blocks::minecraft::pink_stained_glass:
+            case blocks::minecraft::pink_stained_glass_pane:
+                return Rgba8::Make(255, 102, 153, stainedGlassAlpha);
+            case blocks::minecraft::gray_stained_glass:
+            case blocks::minecraft::gray_stained_glass_pane:
+                return Rgba8::Make(118, 118, 118, stainedGlassAlpha);
+            case blocks::minecraft::light_gray_stained_glass:
+            case blocks::minecraft::light_gray_stained_glass_pane:
+                return Rgba8::Make(211, 211, 211, stainedGlassAlpha);
+            case blocks::minecraft::cyan_stained_glass:
+            case blocks::minecraft::cyan_stained_glass_pane:
+                return Rgba8::Make(0, 255, 255, stainedGlassAlpha);
+            case blocks::minecraft::purple_stained_glass:
+            case blocks::minecraft::purple_stained_glass_pane:
+                return Rgba8::Make(128, 0, 128, stainedGlassAlpha);
+            case blocks::minecraft::blue_stained_glass:
+            case blocks::minecraft::blue_stained_glass_pane:
+                return Rgba8::Make(0, 0, 255, stainedGlassAlpha);
+            case blocks::minecraft::brown_stained_glass:
+            case blocks::minecraft::brown_stained_glass_pane:
+                return Rgba8::Make(139, 69, 19, stainedGlassAlpha);
+            case blocks::minecraft::green_stained_glass:
+            case blocks::minecraft::green_stained_glass_pane:
+                return Rgba8::Make(0, 128, 0, stainedGlassAlpha);
+            case blocks::minecraft::red_stained_glass:
+            case blocks::minecraft::red_stained_glass_pane:
+                return Rgba8::Make(255, 0, 0, stainedGlassAlpha);
+            case blocks::minecraft::black_stained_glass:
+            case blocks::minecraft::black_stained_glass_pane:
+                return Rgba8::Make(0, 0, 0, stainedGlassAlpha);
+            default:
+                break;
+        }
+        if (IsTransparentBlock(blockId)) {
+            return Air();
+        }
+        if (IsPlantBlock(blockId)) {
+            return Air();
+        }
+        if (IsTrapdoor(block) && block.property("open") == "true") {
+            return Air();
+        }
+        return Opaque();
+    }
+};
+
+template<class T>
+static T Clamp(T v, T min, T max) {
+    return std::min(std::max(v, min), max);
+}
+
+// 上の層から順に, 1 層 (16x16) 分の列をまとめて走査する. visit が true を返した列は
+// 終わったものとして以降の層では飛ばし, 全ての列が終われば打ち切る.
+template<int Dimension, class Blocks, class Visit>
+static void ScanLayers(Blocks const& chunk, ColumnMask const& columns, Visit&& visit) {
+    array<int, 16 * 16> sky;
+    SkyLevels<Dimension>(chunk, columns, sky);
+    int top = chunk.minBlockY() - 1;
+    for (int idx = 0; idx < 16 * 16; idx++) {
+        if (columns[idx]) {
+            top = max(top, sky[idx]);
+        }
+    }
+    int const sX = chunk.minBlockX();
+    int const sZ = chunk.minBlockZ();
+    ColumnMask pending = columns;
+    for (int y = top; y >= chunk.minBlockY() && pending.any(); y--) {
+        for (int idx = 0; idx < 16 * 16; idx++) {
+            if (!pending[idx] || sky[idx] < y) {
+                continue;
+            }
+            bool waterLike;
+            Block const* block = ColumnBlockAt(chunk, sX + idx % 16, y, sZ + idx / 16, waterLike);
+            if (!block) {
+                continue;
+            }
+            if (visit(idx, y, *block, waterLike)) {
+                pending.reset(idx);
+            }
+        }
+    }
+}
+
+template<int Dimension, class Blocks>
+static void Altitudes(Blocks const& chunk, ColumnMask const& columns, array<int, 16 * 16>& altitude) {
+    altitude.fill(0);
+    ScanLayers<Dimension>(chunk, columns, [&altitude](int idx, int y, Block const& block, bool waterLike) {
+        if (TranslucentBlock::FromBlock(block, waterLike).fA == 255) {
+            altitude[idx] = y;
+            return true;
+        }
+        return false;
+    });
+}
+
+static Rgba8 DiffuseBlockColor(ColorTables const& tables, Rgba8 blockColor, int waterDepth) {
+    if (waterDepth > 0) {
+        return tables.water(waterDepth);
+    }
+    return blockColor;
+}
+
+struct ChunkResult {
+    int chunkX;
+    int chunkZ;
+    // 高さはワールドの範囲 (1.18 以降は -64 から 320) をそのまま持つ.
+    array<int16_t, 16 * 16> altitude;
+    array<Rgba8, 16 * 16> pixels;
+    // 追加のレイヤー. biome と topBlock は LayerNames の表が指定された場合だけ埋める.
+    array<uint8_t, 16 * 16> waterDepth;
+    array<uint16_t, 16 * 16> biome;
+    array<uint16_t, 16 * 16> topBlock;
+};
+
+// 名前で表すレイヤーの番号の表. nullptr のレイヤーは取り出さない.
+struct LayerNames {
+    NameTable* biomes = nullptr;
+    NameTable* blocks = nullptr;
+};
+
+// チャンク内で同じ名前を何度も表から引かないように, 名前の実体のアドレスで覚えておく.
+class ChunkNames {
+public:
+    explicit ChunkNames(NameTable* table)
+        : fTable(table)
+    {
+    }
+
+    uint16_t id(string const* name) {
+        if (!fTable || !name) {
+            return 0;
+        }
+        for (auto const& it : fCache) {
+            if (it.first == name) {
+                return it.second;
+            }
+        }
+        uint16_t const id = fTable->intern(*name);
+        fCache.emplace_back(name, id);
+        return id;
+    }
+
+private:
+    NameTable* const fTable;
+    vector<pair<string const*, uint16_t>> fCache;
+};
+
+static string const* BiomeName(ChunkBlocks const& chunk, int x, int y, int z) {
+    return chunk.biomeAt(x, y, z);
+}
+
+// 1.18 より前の形式のバイオームは番号でしか持っていないので, 不明とする.
+static string const* BiomeName(Chunk const&, int, int, int) {
+    return nullptr;
+}
+
+struct RenderLimits {
+    int maxChunksInFlight;
+    MemoryBudget* budget;
+};
+
+// ラスタ (altitude, pixels, img, エンコード前後のバッファ) 1 リージョン分の見積もり.
+static uint64_t const kRegionMemoryEstimate = 513 * 513 * (sizeof(int16_t) + sizeof(Rgba8)) + 512 * 512 * sizeof(uint32_t) * 4;
+// Layers::columns に書く走査結果 1 リージョン分の見積もり.
+static uint64_t const kColumnSummaryEstimate = 513 * 513 * (sizeof(int16_t) + sizeof(uint8_t) + sizeof(Rgba8));
+// ロード済みのチャンク 1 つ分 (NBT とセクション) の見積もり.
+static uint64_t const kChunkMemoryEstimate = 2 * 1024 * 1024;
+
+static bool Inflate(vector<uint8_t> const& in, vector<uint8_t>& out) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // zlib と gzip のどちらのヘッダーでも受け付ける.
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+        return false;
+    }
+    out.resize(max(out.capacity(), in.size() * 4));
+    stream.next_in = const_cast<Bytef*>(in.data());
+    stream.avail_in = (uInt)in.size();
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+        if (stream.total_out == out.size()) {
+            out.resize(out.size() * 2);
+        }
+        stream.next_out = out.data() + stream.total_out;
+        stream.avail_out = (uInt)(out.size() - stream.total_out);
+        ret = inflate(&stream, Z_NO_FLUSH);
+    }
+    out.resize(stream.total_out);
+    inflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
+
+// 1.18 以降の形式なら NBT から直接展開した blocks を, それ以前の形式なら chunk を使う.
+struct LoadedChunk {
+    shared_ptr<ChunkBlocks> blocks;
+    shared_ptr<Chunk> chunk;
+
+    explicit operator bool() const {
+        return blocks || chunk;
+    }
+
+    template<class F>
+    auto visit(F&& f) const {
+        return blocks ? f(*blocks) : f(*chunk);
+    }
+};
+
+// 読み込み済みの圧縮データからチャンクを作る. 展開用のバッファはスレッド毎に使い回す.
+static LoadedChunk LoadChunk(ChunkBuffer const& buffer) {
+    PerfScope scope(PerfStage::ChunkDecode);
+    AllocScope allocScope(AllocStage::ChunkLoad);
+    thread_local vector<uint8_t> decompressed;
+    LoadedChunk loaded;
+    if (buffer.data.empty() || !Inflate(buffer.data, decompressed)) {
+        return loaded;
+    }
+    auto root = nbt::CompoundTag::Read(decompressed, Endian::Big);
+    if (!root) {
+        return loaded;
+    }
+    loaded.blocks = ChunkBlocks::Make(buffer.chunkX, buffer.chunkZ, *root);
+    if (!loaded.blocks) {
+        loaded.chunk = Chunk::MakeChunk(buffer.chunkX, buffer.chunkZ, root);
+    }
+    return loaded;
+}
+
+template<int Dimension, class Blocks>
+static void ScanColumns(Blocks const& chunk, ColumnMask const& mask, LayerNames const& names, ChunkResult& result) {
+    struct Column {
+        Block const* opaqueBlock = nullptr;
+        TranslucentLayers translucent;
+        int elevation = 0;
+        int waterDepth = 0;
+    };
+    array<Column, 16 * 16> columns;
+
+    ScanLayers<Dimension>(chunk, mask, [&columns](int idx, int y, Block const& block, bool waterLike) {
+        Column& column = columns[idx];
+        if (waterLike) {
+            column.waterDepth++;
+        }
+        auto tb = TranslucentBlock::FromBlock(block, waterLike);
+        if (tb.fA == 255) {
+            column.elevation = y;
+            column.opaqueBlock = &block;
+            return true;
+        }
+        if (tb.fA > 0) {
+            column.translucent.add(tb);
+        }
+        return false;
+    });
+
+    ColorTables const& tables = ColorTables::Get();
+    ChunkNames biomes(names.biomes);
+    ChunkNames blocks(names.blocks);
+    for (int idx = 0; idx < 16 * 16; idx++) {
+        if (!mask[idx]) {
+            continue;
+        }
+        Column const& column = columns[idx];
+        result.waterDepth[idx] = (uint8_t)min(column.waterDepth, 255);
+        result.biome[idx] = 0;
+        result.topBlock[idx] = 0;
+        if (column.opaqueBlock) {
+            result.biome[idx] = biomes.id(BiomeName(chunk, chunk.minBlockX() + idx % 16, column.elevation, chunk.minBlockZ() + idx / 16));
+            result.topBlock[idx] = blocks.id(&column.opaqueBlock->fName);
+        }
+        Rgba8 opaqueBlockColor = Rgba8::Make(0, 0, 0);
+        if (column.opaqueBlock) {
+            if (column.opaqueBlock->fId == blocks::minecraft::grass_block) {
+                opaqueBlockColor = tables.grass(column.elevation);
+            } else {
+                auto color = BlockColor(*column.opaqueBlock);
+                if (color) {
+                    opaqueBlockColor = Rgba8::FromColor(*color);
+                }
+            }
+        }
+        int const waterDepth = min(column.waterDepth, 255);
+        result.pixels[idx] = column.translucent.over(DiffuseBlockColor(tables, opaqueBlockColor, waterDepth));
+        result.altitude[idx] = (int16_t)column.elevation;
+    }
+}
+
+template<int Dimension>
+static optional<ChunkResult> Render(ChunkBuffer buffer, ColumnMask const& columns, LayerNames const& names, ChunkReader* reader, Progress* progress) {
+    AllocScope allocScope(AllocStage::Render);
+
+    int const chunkX = buffer.chunkX;
+    int const chunkZ = buffer.chunkZ;
+    LoadedChunk chunk = LoadChunk(buffer);
+    progress->chunkDone(buffer.data.size());
+    reader->recycle(move(buffer.data));
+    if (!chunk) {
+        progress->error(chunkX >> 5, chunkZ >> 5, "decode", "cannot decode " + Region::GetDefaultCompressedChunkNbtFileName(chunkX, chunkZ));
+        return nullopt;
+    }
+    ChunkResult result;
+    result.chunkX = chunkX;
+    result.chunkZ = chunkZ;
+
+    PerfScope scope(PerfStage::ColumnScan);
+    chunk.visit([&columns, &names, &result](auto const& blocks) {
+        ScanColumns<Dimension>(blocks, columns, names, result);
+    });
+    return result;
+}
+
+template<int Dimension>
+static void LoadedAltitudes(LoadedChunk const& chunk, ColumnMask const& columns, array<int, 16 * 16>& altitude) {
+    chunk.visit([&columns, &altitude](auto const& blocks) {
+        Altitudes<Dimension>(blocks, columns, altitude);
+    });
+}
+
+struct ColumnKernels {
+    optional<ChunkResult> (*render)(ChunkBuffer buffer, ColumnMask const& columns, LayerNames const& names, ChunkReader* reader, Progress* progress);
+    void (*altitudes)(LoadedChunk const& chunk, ColumnMask const& columns, array<int, 16 * 16>& altitude);
+};
+
+// scale 列毎に 1 列ずつ (lx, lz がどちらも scale の倍数の列) を選ぶ. scale は 16 の約数.
+static ColumnMask const& SampledColumns(int scale) {
+    static array<ColumnMask, 17> const sMasks = []() {
+        array<ColumnMask, 17> masks;
+        for (int scale = 1; scale <= 16; scale++) {
+            for (int idx = 0; idx < 16 * 16; idx++) {
+                if (idx % 16 % scale == 0 && idx / 16 % scale == 0) {
+                    masks[scale].set(idx);
+                }
+            }
+        }
+        return masks;
+    }();
+    return sMasks[scale];
+}
+
+template<int Dimension>
+static ColumnKernels MakeColumnKernels() {
+    return {Render<Dimension>, LoadedAltitudes<Dimension>};
+}
+
+static ColumnKernels SelectColumnKernels(int dimension) {
+    switch (dimension) {
+        case -1:
+            return MakeColumnKernels<-1>();
+        case 1:
+            return MakeColumnKernels<1>();
+        default:
+            return MakeColumnKernels<0>();
+    }
+}
+
+// ブロック座標の矩形 [minX, maxX] x [minZ, maxZ] の描画に影響するランドマーク.
+static vector<Landmark> NearbyLandmarks(vector<Landmark> const& landmarks, int dimension, int minX, int minZ, int maxX, int maxZ) {
+    vector<Landmark> nearbyLandmarks;
+    int const minBlockX = minX - kVisibleRadius * 2;
+    int const maxBlockX = maxX + kVisibleRadius * 2;
+
+    int const minBlockZ = minZ - kVisibleRadius * 2;
+    int const maxBlockZ = maxZ + kVisibleRadius * 2;
+    for (auto it = landmarks.begin(); it != landmarks.end(); it++) {
+        if (dimension == it->dimension && minBlockX <= it->x && it->x <= maxBlockX && minBlockZ <= it->z && it->z <= maxBlockZ) {
+            nearbyLandmarks.push_back(*it);
+        }
+    }
+    return nearbyLandmarks;
+}
+
+static vector<Landmark> NearbyLandmarks(vector<Landmark> const& landmarks, int dimension, int regionX, int regionZ) {
+    return NearbyLandmarks(landmarks, dimension, regionX * 512, regionZ * 512, regionX * 512 + 511, regionZ * 512 + 511);
+}
+
+// リージョン内の存在するチャンクと, 北側・西側に隣接するチャンクの読み込み要求.
+static vector<ChunkRequest> RegionChunkRequests(WorldIndex const& index, int regionX, int regionZ) {
+    vector<ChunkRequest> requests;
+    RegionIndex const* region = index.region(regionX, regionZ);
+    if (!region) {
+        return requests;
+    }
+    for (int i = 0; i < 32 * 32; i++) {
+        if (region->fPresent[i]) {
+            requests.push_back({regionX * 32 + i % 32, regionZ * 32 + i / 32});
+        }
+    }
+    for (int lcx = 0; lcx < 32; lcx++) {
+        int const chunkX = regionX * 32 + lcx;
+        int const chunkZ = (regionZ - 1) * 32 + 31;
+        if (index.hasChunk(chunkX, chunkZ)) {
+            requests.push_back({chunkX, chunkZ});
+        }
+    }
+    for (int lcz = 0; lcz < 32; lcz++) {
+        int const chunkX = (regionX - 1) * 32 + 31;
+        int const chunkZ = regionZ * 32 + lcz;
+        if (index.hasChunk(chunkX, chunkZ)) {
+            requests.push_back({chunkX, chunkZ});
+        }
+    }
+    return requests;
+}
+
+// 矩形 [minX, maxX] x [minZ, maxZ] と交わるチャンクと, 北側 1 行・西側 1 列の境界に掛かるチャンクの読み込み要求.
+static vector<ChunkRequest> AreaChunkRequests(WorldIndex const& index, int minX, int minZ, int maxX, int maxZ) {
+    vector<ChunkRequest> requests;
+    // 北西の角のブロックは使わないので, 角だけに掛かるチャンクは読まない.
+    bool const skipCorner = (minX & 15) == 0 && (minZ & 15) == 0;
+    for (int chunkZ = (minZ - 1) >> 4; chunkZ <= maxZ >> 4; chunkZ++) {
+        for (int chunkX = (minX - 1) >> 4; chunkX <= maxX >> 4; chunkX++) {
+            if (skipCorner && chunkX == (minX - 1) >> 4 && chunkZ == (minZ - 1) >> 4) {
+                continue;
+            }
+            if (index.hasChunk(chunkX, chunkZ)) {
+                requests.push_back({chunkX, chunkZ});
+            }
+        }
+    }
+    return requests;
+}
+
+// 呼び出し側が用意したチャンクのうち, チャンク座標の矩形 [minChunkX, maxChunkX] x [minChunkZ, maxChunkZ] に
+// 入るものだけを, 座標毎に最初の 1 つ残す. skipCorner なら北西の角 (minChunkX, minChunkZ) も捨てる.
+// 範囲外や重複したチャンクはラスタの外に書いたり, タイルの待ち数を狂わせたりする.
+static void FilterChunkBuffers(vector<ChunkBuffer>& buffers, int minChunkX, int minChunkZ, int maxChunkX, int maxChunkZ, bool skipCorner, ChunkReader& reader) {
+    set<pair<int, int>> seen;
+    size_t kept = 0;
+    for (size_t i = 0; i < buffers.size(); i++) {
+        ChunkBuffer& buffer = buffers[i];
+        bool const inside = minChunkX <= buffer.chunkX && buffer.chunkX <= maxChunkX && minChunkZ <= buffer.chunkZ && buffer.chunkZ <= maxChunkZ;
+        bool const corner = skipCorner && buffer.chunkX == minChunkX && buffer.chunkZ == minChunkZ;
+        if (!inside || corner || !seen.insert(make_pair(buffer.chunkX, buffer.chunkZ)).second) {
+            reader.recycle(move(buffer.data));
+            continue;
+        }
+        if (kept != i) {
+            buffers[kept] = move(buffer);
+        }
+        kept++;
+    }
+    buffers.resize(kept);
+}
+
+// 陰影を付ける単位. 4x4 チャンク (64x64 ブロック) ずつ, 必要なチャンクが揃ったものから処理する.
+static int const kTileChunks = 4;
+static int const kTiles = 32 / kTileChunks;
+
+// 北側 1 行・西側 1 列の境界を含む幅 width のラスタのうち, [x0, x1) x [z0, z1) に陰影を付けて,
+// 境界を除いた幅 width - 1 の画像に書き込む. ラスタの (0, 0) はブロック座標の (originX, originZ) で,
+// 1 画素が scale ブロックに当たる.
+// 読むのは矩形内と, その北側 1 行・西側 1 列の高度だけ. 全て真っ暗なら true を返す.
+template<bool WithLandmarks>
+static bool ShadeRect(int16_t const* altitude, Rgba8 const* pixels, int width, int originX, int originZ, int scale, vector<Landmark> const& nearbyLandmarks, int x0, int z0, int x1, int z1, uint32_t* img) {
+    PerfScope scope(PerfStage::Shading);
+    AllocScope allocScope(AllocStage::Shading);
+    bool blackout = true;
+
+    // 陰影の倍率. ランドマークが無い場合は明るさが常に 1 なので表を引くだけで済む.
+    static BrightnessTable const bright(1.2f);
+    static BrightnessTable const dark(0.8f);
+    static BrightnessTable const flat(1.0f);
+    ColorTables const& tables = ColorTables::Get();
+
+    for (int z = z0; z < z1; z++) {
+        int const blockZ = originZ + z * scale;
+        for (int x = x0; x < x1; x++) {
+            int const blockX = originX + x * scale;
+            // --bbox のラスタは int の範囲を超えうるので, 位置は size_t で求める.
+            size_t const idx = (size_t)z * width + x;
+            int16_t const h = altitude[idx];
+            uint32_t const c = pixels[idx].color();
+
+            int16_t const hNorth = altitude[idx - width];
+            int16_t const hWest = altitude[idx - 1];
+            int score = 0; // +: bright, -: dark
+            if (hNorth > h) score--;
+            if (hNorth < h) score++;
+            if (hWest > h) score--;
+            if (hWest < h) score++;
+
+            uint8_t r = c & 0xff;
+            uint8_t g = (c >> 8) & 0xff;
+            uint8_t b = (c >> 16) & 0xff;
+            uint8_t alpha = 255;
+            if constexpr (!WithLandmarks) {
+                BrightnessTable const& table = score > 0 ? bright : (score < 0 ? dark : flat);
+                r = table[r];
+                g = table[g];
+                b = table[b];
+                blackout = false;
+            } else {
+                int64_t minDistanceSquared = numeric_limits<int64_t>::max();
+                for (size_t j = 0; j < nearbyLandmarks.size(); j++) {
+                    Landmark const& landmark = nearbyLandmarks[j];
+                    int64_t const dx = blockX - landmark.x;
+                    int64_t const dz = blockZ - landmark.z;
+                    minDistanceSquared = min(minDistanceSquared, dx * dx + dz * dz);
+                }
+                float const brightness = tables.landmarkBrightness(minDistanceSquared);
+                float const coeff = score > 0 ? 1.2f : (score < 0 ? 0.8f : 1.0f);
+                uint32_t const factor = BrightnessTable::Factor(coeff * brightness);
+                r = BrightnessTable::Scale(r, factor);
+                g = BrightnessTable::Scale(g, factor);
+                b = BrightnessTable::Scale(b, factor);
+                alpha = (uint8_t)Clamp(brightness * 255.0f, 0.0f, 255.0f);
+                if (brightness > 0) {
+                    blackout = false;
+                }
+            }
+            size_t const i = (size_t)(z - 1) * (width - 1) + (x - 1);
+            img[i] = ((uint32_t)alpha << 24) | ((uint32_t)b << 16) | ((uint32_t)g << 8) | (uint32_t)r;
+        }
+    }
+    return blackout;
+}
+
+// (512 / scale + 1) 四方のラスタのうちタイル 1 つ分に陰影を付けて, 512 / scale 四方の画像に書き込む.
+template<bool WithLandmarks>
+static bool ShadeTile(int regionX, int regionZ, int scale, vector<int16_t> const& altitude, vector<Rgba8> const& pixels, vector<Landmark> const& nearbyLandmarks, int tileX, int tileZ, uint32_t* img) {
+    int const tileSize = kTileChunks * 16 / scale;
+    int const x0 = 1 + tileX * tileSize;
+    int const z0 = 1 + tileZ * tileSize;
+    return ShadeRect<WithLandmarks>(altitude.data(), pixels.data(), 512 / scale + 1, regionX * 512 - scale, regionZ * 512 - scale, scale, nearbyLandmarks, x0, z0, x0 + tileSize, z0 + tileSize, img);
+}
+
+// リージョン 1 つ分を描画して 512 / scale 四方の RGBA を img に書き込む. scale > 1 の場合は scale 列毎に
+// 1 列だけを走査し, 陰影もその解像度の北・西の高度で付ける. 描画するものが無い場合や
+// 全て真っ暗な場合は false. 呼び出し側でリージョン分のメモリを予約しておくこと.
+// layers には境界を除いた 512 / scale 四方で書き込む.
+static bool RenderRegionImage(vector<Landmark> const& landmarks, int dimension, int regionX, int regionZ, int scale, vector<ChunkBuffer> buffers, ChunkReader& reader, hwm::task_queue& pool, RenderLimits const& limits, Progress& progress, LayerNames const& names, mca2png::Layers const& layers, uint32_t* img, int16_t* altitudeOut) {
+    int const size = 512 / scale;
+    int const width = size + 1;
+    int const height = size + 1;
+
+    FilterChunkBuffers(buffers, regionX * 32 - 1, regionZ * 32 - 1, regionX * 32 + 31, regionZ * 32 + 31, true, reader);
+    vector<ChunkBuffer> chunks;
+    vector<ChunkBuffer> borders;
+    for (auto& buffer : buffers) {
+        if (buffer.chunkX < regionX * 32 || buffer.chunkZ < regionZ * 32) {
+            borders.push_back(move(buffer));
+        } else {
+            chunks.push_back(move(buffer));
+        }
+    }
+    vector<ChunkBuffer>().swap(buffers);
+    if (chunks.empty()) {
+        return false;
+    }
+    if (layers.columns) {
+        layers.columns->reset(regionX, regionZ, scale);
+    }
+    
+    // 走査結果を残す場合は, 後でランドマークを変えて描き直せるように真っ暗でも走査する.
+    vector<Landmark> nearbyLandmarks;
+    if (!landmarks.empty()){
+        nearbyLandmarks = NearbyLandmarks(landmarks, dimension, regionX, regionZ);
+        if (nearbyLandmarks.empty() && !layers.columns) {
+            return false;
+        }
+    }
+    
+    ColumnKernels const kernels = SelectColumnKernels(dimension);
+
+    MemoryBudget& budget = *limits.budget;
+
+    vector<int16_t> altitude(width * height, 0);
+    vector<Rgba8> pixels(width * height, Rgba8::Make(0, 0, 0));
+
+    // ラスタの (0, 0) のブロック座標. 北側・西側の境界は scale ブロック手前の列.
+    int const minX = regionX * 512 - scale;
+    int const minZ = regionZ * 512 - scale;
+    ColumnMask const& sampled = SampledColumns(scale);
+
+    fill_n(img, size * size, 0);
+    if (layers.height) {
+        fill_n(layers.height, size * size, 0);
+    }
+    if (layers.waterDepth) {
+        fill_n(layers.waterDepth, size * size, 0);
+    }
+    if (layers.biome) {
+        fill_n(layers.biome, size * size, 0);
+    }
+    if (layers.topBlock) {
+        fill_n(layers.topBlock, size * size, 0);
+    }
+    auto shadeTile = landmarks.empty() ? ShadeTile<false> : ShadeTile<true>;
+
+    // タイル毎に, まだ終わっていない依存チャンク (タイル内と北側・西側に隣接するもの) の数.
+    bitset<32 * 32> pendingChunks;
+    for (auto const& buffer : chunks) {
+        pendingChunks.set(RegionIndex::Index(buffer.chunkX - regionX * 32, buffer.chunkZ - regionZ * 32));
+    }
+    array<int, kTiles * kTiles> tileWaiting{};
+    for (int tz = 0; tz < kTiles; tz++) {
+        for (int tx = 0; tx < kTiles; tx++) {
+            int waiting = 0;
+            for (int lcz = tz * kTileChunks - 1; lcz < (tz + 1) * kTileChunks; lcz++) {
+                for (int lcx = tx * kTileChunks - 1; lcx < (tx + 1) * kTileChunks; lcx++) {
+                    bool const corner = lcx < tx * kTileChunks && lcz < tz * kTileChunks;
+                    if (lcx < 0 || lcz < 0 || corner) {
+                        continue;
+                    }
+                    if (pendingChunks[RegionIndex::Index(lcx, lcz)]) {
+                        waiting++;
+                    }
+                }
+            }
+            tileWaiting[tz * kTiles + tx] = waiting;
+        }
+    }
+
+    MpscQueue<bool> shadedTiles;
+    auto scheduleTile = [&](int tx, int tz) {
+        pool.enqueue([&, tx, tz]() {
+            shadedTiles.push(shadeTile(regionX, regionZ, scale, altitude, pixels, nearbyLandmarks, tx, tz, img));
+        });
+    };
+    auto chunkFinished = [&](int lcx, int lcz) {
+        auto notify = [&](int tx, int tz) {
+            if (tx < kTiles && tz < kTiles && --tileWaiting[tz * kTiles + tx] == 0) {
+                scheduleTile(tx, tz);
+            }
+        };
+        notify(lcx / kTileChunks, lcz / kTileChunks);
+        if (lcz % kTileChunks == kTileChunks - 1) {
+            notify(lcx / kTileChunks, lcz / kTileChunks + 1);
+        }
+        if (lcx % kTileChunks == kTileChunks - 1) {
+            notify(lcx / kTileChunks + 1, lcz / kTileChunks);
+        }
+    };
+
+    // 結果は完了した順に受け取ってすぐラスタに書き込み, 処理中のチャンク数を抑える.
+    struct Completed {
+        int chunkX;
+        int chunkZ;
+        optional<ChunkResult> result;
+        bool reserved;
+    };
+    MpscQueue<Completed> completed;
+    int const count = (int)chunks.size();
+    int next = 0;
+    int inFlight = 0;
+    bool reservedSlotInUse = false;
+
+    auto dispatch = [&]() {
+        while (next < count && inFlight < limits.maxChunksInFlight) {
+            bool const reserved = !reservedSlotInUse;
+            if (!reserved && !budget.tryAcquire(kChunkMemoryEstimate)) {
+                break;
+            }
+            if (reserved) {
+                reservedSlotInUse = true;
+            }
+            int const chunkX = chunks[next].chunkX;
+            int const chunkZ = chunks[next].chunkZ;
+            pool.enqueue([&completed, &reader, &progress, &sampled, &names, buffer = move(chunks[next]), render = kernels.render, chunkX, chunkZ, reserved]() mutable {
+                completed.push({chunkX, chunkZ, render(move(buffer), sampled, names, &reader, &progress), reserved});
+            });
+            next++;
+            inFlight++;
+        }
+    };
+
+    // 境界のチャンクも読み込んで展開するので, チャンク数と読み込んだバイト数に含める.
+    progress.addChunks(count + (int)borders.size());
+    dispatch();
+
+    // 北側と西側. 自分のチャンクを処理している間に, このスレッドで先に済ませておく.
+    bitset<32> northFilled;
+    bitset<32> westFilled;
+    for (auto& buffer : borders) {
+        LoadedChunk chunk = LoadChunk(buffer);
+        progress.chunkDone(buffer.data.size());
+        reader.recycle(move(buffer.data));
+        if (!chunk) {
+            progress.error(regionX, regionZ, "decode", "cannot decode " + Region::GetDefaultCompressedChunkNbtFileName(buffer.chunkX, buffer.chunkZ));
+            continue;
+        }
+        PerfScope scope(PerfStage::ColumnScan);
+        // 北側のチャンクは南端の行, 西側のチャンクは東端の列だけが必要.
+        bool const north = buffer.chunkZ < regionZ * 32;
+        ColumnMask columns;
+        for (int i = 0; i < 16; i += scale) {
+            columns.set(north ? (16 - scale) * 16 + i : i * 16 + 16 - scale);
+        }
+        array<int, 16 * 16> edge;
+        kernels.altitudes(chunk, columns, edge);
+        for (int idx = 0; idx < 16 * 16; idx++) {
+            if (!columns[idx]) {
+                continue;
+            }
+            int const x = buffer.chunkX * 16 + idx % 16;
+            int const z = buffer.chunkZ * 16 + idx / 16;
+            altitude[(z - minZ) / scale * width + (x - minX) / scale] = edge[idx];
+        }
+        if (north) {
+            northFilled.set(buffer.chunkX - regionX * 32);
+        } else {
+            westFilled.set(buffer.chunkZ - regionZ * 32);
+        }
+    }
+
+    for (int tz = 0; tz < kTiles; tz++) {
+        for (int tx = 0; tx < kTiles; tx++) {
+            if (tileWaiting[tz * kTiles + tx] == 0) {
+                scheduleTile(tx, tz);
+            }
+        }
+    }
+
+    while (inFlight > 0) {
+        Completed c = completed.pop();
+        inFlight--;
+        if (c.reserved) {
+            reservedSlotInUse = false;
+        } else {
+            budget.release(kChunkMemoryEstimate);
+        }
+        int const lcx = c.chunkX - regionX * 32;
+        int const lcz = c.chunkZ - regionZ * 32;
+        if (c.result) {
+            AllocScope allocScope(AllocStage::Merge);
+            ChunkResult const& result = *c.result;
+            // チャンク 1 つはラスタ上で perChunk 四方.
+            int const perChunk = 16 / scale;
+            int const x0 = (result.chunkX * 16 - minX) / scale;
+            int const z0 = (result.chunkZ * 16 - minZ) / scale;
+            if (scale == 1) {
+                for (int lz = 0; lz < 16; lz++) {
+                    copy_n(result.altitude.begin() + lz * 16, 16, altitude.begin() + (z0 + lz) * width + x0);
+                    copy_n(result.pixels.begin() + lz * 16, 16, pixels.begin() + (z0 + lz) * width + x0);
+                }
+            } else {
+                for (int z = 0; z < perChunk; z++) {
+                    for (int x = 0; x < perChunk; x++) {
+                        int const idx = z * scale * 16 + x * scale;
+                        altitude[(z0 + z) * width + x0 + x] = result.altitude[idx];
+                        pixels[(z0 + z) * width + x0 + x] = result.pixels[idx];
+                    }
+                }
+            }
+            // レイヤーには境界が無いので, ラスタから 1 行 1 列ずらして直接書き込む.
+            for (int z = 0; z < perChunk; z++) {
+                for (int x = 0; x < perChunk; x++) {
+                    int const idx = z * scale * 16 + x * scale;
+                    int const i = (z0 + z - 1) * size + x0 + x - 1;
+                    if (layers.height) {
+                        layers.height[i] = result.altitude[idx];
+                    }
+                    if (layers.waterDepth) {
+                        layers.waterDepth[i] = result.waterDepth[idx];
+                    }
+                    if (layers.biome) {
+                        layers.biome[i] = result.biome[idx];
+                    }
+                    if (layers.topBlock) {
+                        layers.topBlock[i] = result.topBlock[idx];
+                    }
+                    if (layers.columns) {
+                        int const r = (z0 + z) * width + x0 + x;
+                        layers.columns->waterDepth[r] = result.waterDepth[idx];
+                        layers.columns->color[r] = result.pixels[idx];
+                    }
+                }
+            }
+
+            // 北側のチャンクが無い場合は, 1 行南の高度をデフォルト値に使う.
+            if (lcz == 0 && !northFilled[lcx]) {
+                for (int x = x0; x < min(x0 + perChunk, size); x++) {
+                    altitude[x] = altitude[width + x];
+                }
+            }
+
+            // 西側のチャンクが無い場合は, 1 列東の高度をデフォルト値に使う.
+            if (lcx == 0 && !westFilled[lcz]) {
+                for (int z = z0; z < min(z0 + perChunk, size); z++) {
+                    altitude[z * width] = altitude[z * width + 1];
+                }
+            }
+        }
+        chunkFinished(lcx, lcz);
+        dispatch();
+    }
+
+    bool blackout = true;
+    for (int i = 0; i < kTiles * kTiles; i++) {
+        if (!shadedTiles.pop()) {
+            blackout = false;
+        }
+    }
+
+    if (altitudeOut) {
+        for (int z = 0; z < size; z++) {
+            copy_n(altitude.begin() + (z + 1) * width + 1, size, altitudeOut + z * size);
+        }
+    }
+    if (layers.columns) {
+        layers.columns->elevation = altitude;
+    }
+    return !blackout;
+}
+
+// 矩形 [minX, maxX] x [minZ, maxZ] 1 つ分のラスタと画像の見積もり.
+static uint64_t AreaMemoryEstimate(int minX, int minZ, int maxX, int maxZ) {
+    uint64_t const cells = (uint64_t)(maxX - minX + 2) * (uint64_t)(maxZ - minZ + 2);
+    return cells * (sizeof(int16_t) + sizeof(Rgba8) + sizeof(uint32_t) * 4);
+}
+
+// ブロック座標の矩形 [minX, maxX] x [minZ, maxZ] を描画して, 幅 maxX - minX + 1 の RGBA を img に書き込む.
+// 矩形と交わるチャンクだけを走査し, 境界だけに掛かるチャンクは必要な列の高度だけを調べる.
+static bool RenderAreaImage(vector<Landmark> const& landmarks, int dimension, int minX, int minZ, int maxX, int maxZ, vector<ChunkBuffer> buffers, ChunkReader& reader, hwm::task_queue& pool, RenderLimits const& limits, Progress& progress, uint32_t* img, int16_t* altitudeOut) {
+    int const width = maxX - minX + 2;
+    int const height = maxZ - minZ + 2;
+    int const originX = minX - 1;
+    int const originZ = minZ - 1;
+
+    FilterChunkBuffers(buffers, originX >> 4, originZ >> 4, maxX >> 4, maxZ >> 4, (minX & 15) == 0 && (minZ & 15) == 0, reader);
+    vector<ChunkBuffer> chunks;
+    vector<ChunkBuffer> borders;
+    for (auto& buffer : buffers) {
+        bool const inside = minX <= buffer.chunkX * 16 + 15 && buffer.chunkX * 16 <= maxX && minZ <= buffer.chunkZ * 16 + 15 && buffer.chunkZ * 16 <= maxZ;
+        if (inside) {
+            chunks.push_back(move(buffer));
+        } else {
+            borders.push_back(move(buffer));
+        }
+    }
+    vector<ChunkBuffer>().swap(buffers);
+    if (chunks.empty()) {
+        return false;
+    }
+
+    vector<Landmark> nearbyLandmarks;
+    if (!landmarks.empty()) {
+        nearbyLandmarks = NearbyLandmarks(landmarks, dimension, minX, minZ, maxX, maxZ);
+        if (nearbyLandmarks.empty()) {
+            return false;
+        }
+    }
+
+    ColumnKernels const kernels = SelectColumnKernels(dimension);
+
+    vector<int16_t> altitude((size_t)width * height, 0);
+    vector<Rgba8> pixels((size_t)width * height, Rgba8::Make(0, 0, 0));
+    fill_n(img, (size_t)(width - 1) * (height - 1), 0);
+    vector<bool> northFilled(width, false);
+    vector<bool> westFilled(height, false);
+
+    // チャンク内の列 (lx, lz) に対応するラスタ上の位置. ラスタの外か, 使わない北西の角なら -1.
+    auto rasterIndex = [&](int chunkX, int chunkZ, int lx, int lz) -> int64_t {
+        int const x = chunkX * 16 + lx - originX;
+        int const z = chunkZ * 16 + lz - originZ;
+        if (x < 0 || width <= x || z < 0 || height <= z || (x == 0 && z == 0)) {
+            return -1;
+        }
+        if (z == 0) {
+            northFilled[x] = true;
+        }
+        if (x == 0) {
+            westFilled[z] = true;
+        }
+        return (int64_t)z * width + x;
+    };
+
+    struct Completed {
+        optional<ChunkResult> result;
+    };
+    MpscQueue<Completed> completed;
+    int const count = (int)chunks.size();
+    int next = 0;
+    int inFlight = 0;
+    auto dispatch = [&]() {
+        while (next < count && inFlight < limits.maxChunksInFlight) {
+            pool.enqueue([&completed, &reader, &progress, buffer = move(chunks[next]), render = kernels.render]() mutable {
+                completed.push({render(move(buffer), SampledColumns(1), LayerNames(), &reader, &progress)});
+            });
+            next++;
+            inFlight++;
+        }
+    };
+
+    // 境界のチャンクも読み込んで展開するので, チャンク数と読み込んだバイト数に含める.
+    progress.addChunks(count + (int)borders.size());
+    dispatch();
+
+    // 境界だけに掛かるチャンク. 内側のチャンクを処理している間に, このスレッドで先に済ませておく.
+    for (auto& buffer : borders) {
+        LoadedChunk chunk = LoadChunk(buffer);
+        progress.chunkDone(buffer.data.size());
+        reader.recycle(move(buffer.data));
+        if (!chunk) {
+            progress.error(buffer.chunkX >> 5, buffer.chunkZ >> 5, "decode", "cannot decode " + Region::GetDefaultCompressedChunkNbtFileName(buffer.chunkX, buffer.chunkZ));
+            continue;
+        }
+        PerfScope scope(PerfStage::ColumnScan);
+        ColumnMask columns;
+        for (int idx = 0; idx < 16 * 16; idx++) {
+            int const x = buffer.chunkX * 16 + idx % 16 - originX;
+            int const z = buffer.chunkZ * 16 + idx / 16 - originZ;
+            if (0 <= x && x < width && 0 <= z && z < height && (x == 0) != (z == 0)) {
+                columns.set(idx);
+            }
+        }
+        array<int, 16 * 16> edge;
+        kernels.altitudes(chunk, columns, edge);
+        for (int idx = 0; idx < 16 * 16; idx++) {
+            if (columns[idx]) {
+                altitude[rasterIndex(buffer.chunkX, buffer.chunkZ, idx % 16, idx / 16)] = edge[idx];
+            }
+        }
+    }
+
+    while (inFlight > 0) {
+        Completed c = completed.pop();
+        inFlight--;
+        if (c.result) {
+            AllocScope allocScope(AllocStage::Merge);
+            ChunkResult const& result = *c.result;
+            for (int idx = 0; idx < 16 * 16; idx++) {
+                int64_t const i = rasterIndex(result.chunkX, result.chunkZ, idx % 16, idx / 16);
+                if (i >= 0) {
+                    altitude[i] = result.altitude[idx];
+                    pixels[i] = result.pixels[idx];
+                }
+            }
+        }
+        dispatch();
+    }
+
+    // 北側・西側のチャンクが無い場合は, 1 ブロック南・東の高度をデフォルト値に使う.
+    for (int x = 1; x < width; x++) {
+        if (!northFilled[x]) {
+            altitude[x] = altitude[width + x];
+        }
+    }
+    for (int z = 1; z < height; z++) {
+        if (!westFilled[z]) {
+            altitude[(size_t)z * width] = altitude[(size_t)z * width + 1];
+        }
+    }
+
+    // 陰影は 64 行ずつに分けて並列に付ける.
+    auto shadeRect = nearbyLandmarks.empty() ? ShadeRect<false> : ShadeRect<true>;
+    MpscQueue<bool> shaded;
+    int bands = 0;
+    for (int z0 = 1; z0 < height; z0 += 64, bands++) {
+        int const z1 = min(z0 + 64, height);
+        pool.enqueue([&, z0, z1]() {
+            shaded.push(shadeRect(altitude.data(), pixels.data(), width, originX, originZ, 1, nearbyLandmarks, 1, z0, width, z1, img));
+        });
+    }
+    bool blackout = true;
+    for (int i = 0; i < bands; i++) {
+        if (!shaded.pop()) {
+            blackout = false;
+        }
+    }
+
+    if (altitudeOut) {
+        for (int z = 1; z < height; z++) {
+            copy_n(altitude.begin() + (size_t)z * width + 1, width - 1, altitudeOut + (size_t)(z - 1) * (width - 1));
+        }
+    }
+    return !blackout;
+}
+
+// ColumnSummary に残した列の色に陰影を付け直す. 結果は同じ走査結果から RenderRegionImage で
+// 描いたものと同じになる.
+static bool ReshadeRegionImage(vector<Landmark> const& landmarks, int dimension, ColumnSummary const& columns, hwm::task_queue& pool, uint32_t* img, int16_t* altitudeOut) {
+    int const scale = columns.scale;
+    int const width = columns.width;
+    int const size = width - 1;
+    size_t const cells = (size_t)width * width;
+    if (width != 512 / scale + 1 || columns.elevation.size() != cells || columns.waterDepth.size() != cells || columns.color.size() != cells) {
+        return false;
+    }
+    vector<Landmark> nearbyLandmarks;
+    if (!landmarks.empty()) {
+        nearbyLandmarks = NearbyLandmarks(landmarks, dimension, columns.regionX, columns.regionZ);
+        if (nearbyLandmarks.empty()) {
+            return false;
+        }
+    }
+
+    fill_n(img, size * size, 0);
+    auto shadeRect = landmarks.empty() ? ShadeRect<false> : ShadeRect<true>;
+    int const originX = columns.regionX * 512 - scale;
+    int const originZ = columns.regionZ * 512 - scale;
+    MpscQueue<bool> shaded;
+    int bands = 0;
+    for (int z0 = 1; z0 < width; z0 += 64, bands++) {
+        int const z1 = min(z0 + 64, width);
+        pool.enqueue([&, z0, z1]() {
+            shaded.push(shadeRect(columns.elevation.data(), columns.color.data(), width, originX, originZ, scale, nearbyLandmarks, 1, z0, width, z1, img));
+        });
+    }
+    bool blackout = true;
+    for (int i = 0; i < bands; i++) {
+        if (!shaded.pop()) {
+            blackout = false;
+        }
+    }
+
+    if (altitudeOut) {
+        for (int z = 0; z < size; z++) {
+            copy_n(columns.elevation.begin() + (z + 1) * width + 1, size, altitudeOut + z * size);
+        }
+    }
+    return !blackout;
+}
+
+namespace mca2png {
+
+struct World::Impl {
+    struct Dimension {
+        fs::path fDirectory;
+        // ChunkReader::open の戻り値
+        int fReaderDirectory;
+        shared_ptr<WorldIndex> fIndex;
+    };
+
+    explicit Impl(Options options)
+        : fLandmarks(move(options.landmarks))
+        , fThreads(options.threads > 0 ? options.threads : max(thread::hardware_concurrency(), 1u))
+        , fMaxChunksInFlight(options.maxChunksInFlight > 0 ? options.maxChunksInFlight : (int)fThreads * 2)
+        , fOwnProgress(options.progress ? nullptr : make_unique<Progress>(0, string()))
+        , fProgress(options.progress ? options.progress : fOwnProgress.get())
+        , fBudget(options.maxMemory)
+        , fReader(fProgress)
+        , fPool(fThreads)
+    {
+    }
+
+    // 索引を読む間は fIndexMutex を取っておくこと.
+    WorldIndex const* index(int dimension) const {
+        auto found = fDimensions.find(dimension);
+        return found == fDimensions.end() ? nullptr : found->second.fIndex.get();
+    }
+
+    vector<Landmark> const fLandmarks;
+    unsigned int const fThreads;
+    int const fMaxChunksInFlight;
+
+    mutable mutex fIndexMutex;
+    map<int, Dimension> fDimensions;
+
+    unique_ptr<Progress> fOwnProgress;
+    Progress* fProgress;
+    MemoryBudget fBudget;
+    ChunkReader fReader;
+    NameTable fBiomeNames;
+    NameTable fBlockNames;
+    hwm::task_queue fPool;
+};
+
+unique_ptr<World> World::Open(map<int, fs::path> const& dimensions, Options options, fs::path* failed) {
+    unique_ptr<World> world(new World(move(options)));
+    for (auto const& it : dimensions) {
+        Impl::Dimension dimension;
+        dimension.fDirectory = it.second;
+        dimension.fIndex = WorldIndex::Build(it.second);
+        dimension.fReaderDirectory = world->fImpl->fReader.open(it.second);
+        if (!dimension.fIndex || dimension.fReaderDirectory < 0) {
+            if (failed) {
+                *failed = it.second / "chunk";
+            }
+            return nullptr;
+        }
+        world->fImpl->fDimensions[it.first] = move(dimension);
+    }
+    // ワーカーが使い始める前に色の表を作っておく.
+    ColorTables::Get();
+    return world;
+}
+
+unique_ptr<World> World::Open(fs::path const& directory, int dimension, Options options) {
+    return Open(map<int, fs::path>{{dimension, directory}}, move(options));
+}
+
+World::World(Options options)
+    : fImpl(make_unique<Impl>(move(options)))
+{
+}
+
+World::~World() {
+}
+
+vector<string> World::biomeNames() const {
+    return fImpl->fBiomeNames.names();
+}
+
+vector<string> World::blockNames() const {
+    return fImpl->fBlockNames.names();
+}
+
+Progress& World::progress() {
+    return *fImpl->fProgress;
+}
+
+vector<pair<int, int>> World::regions(int dimension) const {
+    lock_guard<mutex> lock(fImpl->fIndexMutex);
+    WorldIndex const* index = fImpl->index(dimension);
+    return index ? index->regions() : vector<pair<int, int>>();
+}
+
+bool World::hasRegion(int dimension, int regionX, int regionZ) const {
+    lock_guard<mutex> lock(fImpl->fIndexMutex);
+    WorldIndex const* index = fImpl->index(dimension);
+    return index && index->region(regionX, regionZ) != nullptr;
+}
+
+int World::chunks(int dimension, int regionX, int regionZ) const {
+    lock_guard<mutex> lock(fImpl->fIndexMutex);
+    WorldIndex const* index = fImpl->index(dimension);
+    RegionIndex const* region = index ? index->region(regionX, regionZ) : nullptr;
+    return region ? region->chunks() : 0;
+}
+
+uint64_t World::compressedBytes(int dimension, int regionX, int regionZ) const {
+    lock_guard<mutex> lock(fImpl->fIndexMutex);
+    WorldIndex const* index = fImpl->index(dimension);
+    RegionIndex const* region = index ? index->region(regionX, regionZ) : nullptr;
+    if (!region) {
+        return 0;
+    }
+    uint64_t bytes = 0;
+    for (int i = 0; i < 32 * 32; i++) {
+        if (region->fPresent[i]) {
+            bytes += region->fSizes[i];
+        }
+    }
+    return bytes;
+}
+
+bool World::visible(int dimension, int regionX, int regionZ) const {
+    return fImpl->fLandmarks.empty() || !NearbyLandmarks(fImpl->fLandmarks, dimension, regionX, regionZ).empty();
+}
+
+future<vector<ChunkBuffer>> World::fetch(int dimension, int regionX, int regionZ) {
+    vector<ChunkRequest> requests;
+    int directory = -1;
+    {
+        lock_guard<mutex> lock(fImpl->fIndexMutex);
+        if (auto found = fImpl->fDimensions.find(dimension); found != fImpl->fDimensions.end()) {
+            requests = RegionChunkRequests(*found->second.fIndex, regionX, regionZ);
+            directory = found->second.fReaderDirectory;
+        }
+    }
+    return fImpl->fReader.fetch(directory, move(requests));
+}
+
+bool World::renderRegion(int dimension, int regionX, int regionZ, uint32_t* rgba, int16_t* altitude, int scale, Layers const& layers) {
+    return renderRegion(dimension, regionX, regionZ, fetch(dimension, regionX, regionZ).get(), rgba, altitude, scale, layers);
+}
+
+bool World::renderRegion(int dimension, int regionX, int regionZ, vector<ChunkBuffer> chunks, uint32_t* rgba, int16_t* altitude, int scale, Layers const& layers) {
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+        return false;
+    }
+    // 処理中のチャンク 1 つ分は常に使えるように, リージョンと一緒に予約しておく.
+    MemoryReservation reservation(fImpl->fBudget, kRegionMemoryEstimate + kChunkMemoryEstimate + (layers.columns ? kColumnSummaryEstimate : 0));
+    RenderLimits limits;
+    limits.maxChunksInFlight = fImpl->fMaxChunksInFlight;
+    limits.budget = &fImpl->fBudget;
+    LayerNames names;
+    names.biomes = layers.biome ? &fImpl->fBiomeNames : nullptr;
+    names.blocks = layers.topBlock ? &fImpl->fBlockNames : nullptr;
+    return RenderRegionImage(fImpl->fLandmarks, dimension, regionX, regionZ, scale, move(chunks), fImpl->fReader, fImpl->fPool, limits, *fImpl->fProgress, names, layers, rgba, altitude);
+}
+
+bool World::renderArea(int dimension, int minX, int minZ, int maxX, int maxZ, uint32_t* rgba, int16_t* altitude) {
+    vector<ChunkRequest> requests;
+    int directory = -1;
+    {
+        lock_guard<mutex> lock(fImpl->fIndexMutex);
+        if (auto found = fImpl->fDimensions.find(dimension); found != fImpl->fDimensions.end()) {
+            requests = AreaChunkRequests(*found->second.fIndex, minX, minZ, maxX, maxZ);
+            directory = found->second.fReaderDirectory;
+        }
+    }
+    return renderArea(dimension, minX, minZ, maxX, maxZ, fImpl->fReader.fetch(directory, move(requests)).get(), rgba, altitude);
+}
+
+bool World::renderArea(int dimension, int minX, int minZ, int maxX, int maxZ, vector<ChunkBuffer> chunks, uint32_t* rgba, int16_t* altitude) {
+    if (maxX < minX || maxZ < minZ || (int64_t)maxX - minX >= kMaxAreaSize || (int64_t)maxZ - minZ >= kMaxAreaSize) {
+        return false;
+    }
+    int const inFlight = min(fImpl->fMaxChunksInFlight, (int)chunks.size());
+    MemoryReservation reservation(fImpl->fBudget, AreaMemoryEstimate(minX, minZ, maxX, maxZ) + kChunkMemoryEstimate * max(inFlight, 1));
+    RenderLimits limits;
+    limits.maxChunksInFlight = fImpl->fMaxChunksInFlight;
+    limits.budget = &fImpl->fBudget;
+    return RenderAreaImage(fImpl->fLandmarks, dimension, minX, minZ, maxX, maxZ, move(chunks), fImpl->fReader, fImpl->fPool, limits, *fImpl->fProgress, rgba, altitude);
+}
+
+bool World::reshade(int dimension, ColumnSummary const& columns, uint32_t* rgba, int16_t* altitude) {
+    MemoryReservation reservation(fImpl->fBudget, kRegionMemoryEstimate + kColumnSummaryEstimate);
+    return ReshadeRegionImage(fImpl->fLandmarks, dimension, columns, fImpl->fPool, rgba, altitude);
+}
+
+void World::applyChanges(int dimension, ChunkChanges const& changes, set<pair<int, int>>& direct, set<pair<int, int>>& border) {
+    lock_guard<mutex> lock(fImpl->fIndexMutex);
+    auto found = fImpl->fDimensions.find(dimension);
+    if (found == fImpl->fDimensions.end()) {
+        return;
+    }
+    Impl::Dimension& d = found->second;
+    if (changes.overflow) {
+        if (auto rebuilt = WorldIndex::Build(d.fDirectory)) {
+            d.fIndex = rebuilt;
+        }
+        for (auto const& r : d.fIndex->regions()) {
+            direct.insert(r);
+        }
+    }
+    for (auto const& chunk : changes.chunks) {
+        // 書き込みが終わったのに内容が変わっていないチャンクは描き直さない.
+        if (!d.fIndex->refresh(chunk.first, chunk.second) && !changes.overflow) {
+            continue;
+        }
+        int const rx = chunk.first >> 5;
+        int const rz = chunk.second >> 5;
+        direct.insert(make_pair(rx, rz));
+        if ((chunk.first & 31) == 31) {
+            border.insert(make_pair(rx + 1, rz));
+        }
+        if ((chunk.second & 31) == 31) {
+            border.insert(make_pair(rx, rz + 1));
+        }
+    }
+}
+
+} // namespace mca2png
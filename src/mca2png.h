@@ -0,0 +1,132 @@
+#pragma once
+
+#include "chunk_watcher.h"
+#include "column_summary.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct ChunkBuffer;
+class Progress;
+
+// mca2png の描画部分. 呼び出し側が用意したバッファにリージョン 1 つ分の画像と高度を書き込む.
+namespace mca2png {
+
+// 出力する画像と高度の一辺. バッファは行優先 (z * kRegionSize + x) で kRegionSize^2 要素.
+int const kRegionSize = 512;
+
+struct Landmark {
+    int dimension;
+    int x;
+    int z;
+};
+
+// 地図と同じ走査で取り出す追加のレイヤー. 必要なものだけ, 画像と同じ大きさの行優先のバッファを指定する.
+struct Layers {
+    // 最上部の不透明なブロックの高さ. renderRegion の altitude と同じもの.
+    int16_t* height = nullptr;
+    // 最上部の不透明なブロックより上にある水のブロック数. 255 で頭打ち.
+    uint8_t* waterDepth = nullptr;
+    // 最上部の不透明なブロックの位置のバイオーム. World::biomeNames の番号で, 0 は不明.
+    uint16_t* biome = nullptr;
+    // 最上部の不透明なブロック. World::blockNames の番号で, 0 は無し.
+    uint16_t* topBlock = nullptr;
+    // 陰影を付ける前の走査結果. 境界を含む (512 / scale + 1) 四方に作り直す. 指定すると,
+    // 近くにランドマークが無いリージョンも描画する (結果は真っ暗なので false を返す).
+    ColumnSummary* columns = nullptr;
+};
+
+// ディメンション番号. 0: オーバーワールド, -1: ネザー, 1: ジ・エンド.
+int const kOverworld = 0;
+int const kNether = -1;
+int const kTheEnd = 1;
+
+// 開いたワールド. ディメンション毎のチャンクの索引と, 全ディメンションで共有する I/O スレッド,
+// スレッドプール, メモリの予算を持つ. 複数のスレッドから同時に renderRegion を呼んでよい.
+class World {
+public:
+    struct Options {
+        // 0 なら CPU のコア数
+        unsigned int threads = 0;
+        // リージョンとチャンクの予約に使うメモリの上限. 0 なら無制限.
+        uint64_t maxMemory = 0;
+        // リージョン毎に同時に処理するチャンク数. 0 ならスレッド数の 2 倍.
+        int maxChunksInFlight = 0;
+        // 空でなければ, 近くのランドマークから遠い場所ほど暗く (透明に) 描く.
+        std::vector<Landmark> landmarks;
+        // 進捗とエラーの報告先. nullptr ならエラーを標準エラー出力に書くだけ.
+        Progress* progress = nullptr;
+    };
+
+    // ディメンション毎に, chunk ディレクトリを含むディレクトリを指定する.
+    // どれかの world/chunk を読めない場合は nullptr を返し, failed にはその chunk ディレクトリを入れる.
+    static std::unique_ptr<World> Open(std::map<int, std::filesystem::path> const& dimensions, Options options, std::filesystem::path* failed = nullptr);
+    // ディメンションが 1 つだけの場合.
+    static std::unique_ptr<World> Open(std::filesystem::path const& directory, int dimension, Options options);
+    ~World();
+
+    World(World const&) = delete;
+    World& operator=(World const&) = delete;
+
+    // 開いていないディメンションは, リージョンが 1 つも無いものとして扱う.
+    std::vector<std::pair<int, int>> regions(int dimension) const;
+    bool hasRegion(int dimension, int regionX, int regionZ) const;
+    int chunks(int dimension, int regionX, int regionZ) const;
+    // リージョン内のチャンクファイルの合計サイズ. 描画にかかる時間の見積もりに使う.
+    uint64_t compressedBytes(int dimension, int regionX, int regionZ) const;
+    // ランドマークが指定されていて, 近くに 1 つも無いリージョンは描画しても真っ暗なので false.
+    bool visible(int dimension, int regionX, int regionZ) const;
+
+    // リージョンのチャンクと, 北側・西側に隣接するチャンクの圧縮されたままのデータを読み込む.
+    std::future<std::vector<ChunkBuffer>> fetch(int dimension, int regionX, int regionZ);
+
+    // rgba には 512x512 の RGBA (R が下位バイト) を, altitude には各列の最上部の不透明なブロックの
+    // 高さを書き込む. altitude は nullptr でもよい. 描画するものが無い場合や, 全て真っ暗な場合は false.
+    // scale (2, 4, 8) を指定すると scale 列毎に 1 列だけを走査し, 512 / scale 四方の縮小画像にする.
+    // layers に指定したレイヤーも同じ大きさで書き込む.
+    bool renderRegion(int dimension, int regionX, int regionZ, uint32_t* rgba, int16_t* altitude, int scale = 1, Layers const& layers = Layers());
+    // 読み込み済みのチャンクから描画する. chunks は c.X.Z.nbt.z の中身 (zlib か gzip で圧縮された NBT) で,
+    // 陰影のために北側・西側に隣接するチャンクも含めておく. それ以外の場所のチャンクと, 同じ座標の 2 つ目以降は無視する.
+    bool renderRegion(int dimension, int regionX, int regionZ, std::vector<ChunkBuffer> chunks, uint32_t* rgba, int16_t* altitude, int scale = 1, Layers const& layers = Layers());
+
+    // renderArea の矩形の 1 辺の最大 (ブロック数). 画像だけで 1 GiB になる.
+    static int const kMaxAreaSize = 16384;
+
+    // ブロック座標の矩形 [minX, maxX] x [minZ, maxZ] を描画する. rgba と altitude は幅 maxX - minX + 1,
+    // 高さ maxZ - minZ + 1 の行優先. 読み込むのは矩形と交わるチャンクと, 北側・西側の境界のチャンクだけ.
+    // 辺が kMaxAreaSize を超える場合は false. chunks を渡す場合, 読み込む範囲の外と重複したものは無視する.
+    bool renderArea(int dimension, int minX, int minZ, int maxX, int maxZ, uint32_t* rgba, int16_t* altitude);
+    bool renderArea(int dimension, int minX, int minZ, int maxX, int maxZ, std::vector<ChunkBuffer> chunks, uint32_t* rgba, int16_t* altitude);
+
+    // 走査結果から陰影だけを付け直す. チャンクは読まない. 引数と戻り値は renderRegion と同じで,
+    // 画像の大きさは columns.scale で決まる.
+    bool reshade(int dimension, ColumnSummary const& columns, uint32_t* rgba, int16_t* altitude);
+
+    // 変更されたチャンクを索引に反映して, 描画し直すべきリージョンを集める. direct はチャンクが変更された
+    // リージョン, border はその高度を北側・西側の境界に使う南・東のリージョン. 大きさと更新時刻が
+    // 索引と同じチャンクは変更されていないものとして扱う.
+    void applyChanges(int dimension, ChunkChanges const& changes, std::set<std::pair<int, int>>& direct, std::set<std::pair<int, int>>& border);
+
+    // Layers::biome, Layers::topBlock の番号 id の名前は names[id - 1]. 描画する度に増えていく.
+    std::vector<std::string> biomeNames() const;
+    std::vector<std::string> blockNames() const;
+
+    Progress& progress();
+
+private:
+    struct Impl;
+
+    explicit World(Options options);
+
+private:
+    std::unique_ptr<Impl> fImpl;
+};
+
+} // namespace mca2png
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// スケジューラが確保量の見積もりを予約するためのカウンタ. limit が 0 なら無制限.
+class MemoryBudget {
+public:
+    explicit MemoryBudget(uint64_t limit)
+        : fLimit(limit)
+        , fUsed(0)
+    {
+    }
+
+    // limit を超える要求でも, 他に誰も予約していなければ通す.
+    void acquire(uint64_t bytes) {
+        if (fLimit == 0) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(fMutex);
+        fCv.wait(lock, [this, bytes]() { return fUsed == 0 || fUsed + bytes <= fLimit; });
+        fUsed += bytes;
+    }
+
+    bool tryAcquire(uint64_t bytes) {
+        if (fLimit == 0) {
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(fMutex);
+        if (fUsed + bytes > fLimit) {
+            return false;
+        }
+        fUsed += bytes;
+        return true;
+    }
+
+    void release(uint64_t bytes) {
+        if (fLimit == 0) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fUsed -= bytes;
+        }
+        fCv.notify_all();
+    }
+
+private:
+    uint64_t const fLimit;
+    uint64_t fUsed;
+    std::mutex fMutex;
+    std::condition_variable fCv;
+};
+
+class MemoryReservation {
+public:
+    MemoryReservation(MemoryBudget& budget, uint64_t bytes)
+        : fBudget(budget)
+        , fBytes(bytes)
+    {
+        fBudget.acquire(fBytes);
+    }
+
+    ~MemoryReservation() {
+        fBudget.release(fBytes);
+    }
+
+    MemoryReservation(MemoryReservation const&) = delete;
+    MemoryReservation& operator=(MemoryReservation const&) = delete;
+
+private:
+    MemoryBudget& fBudget;
+    uint64_t const fBytes;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+// 複数の producer から lock-free に push でき, 1 つの consumer が完了順に取り出すキュー.
+// (Dmitry Vyukov の non-intrusive MPSC queue)
+// consumer は最後の値を取り出した直後にキューを破棄してよい. デストラクタは push の途中の producer が
+// 抜けるのを待つ.
+template<class T>
+class MpscQueue {
+    struct Node {
+        std::atomic<Node*> fNext;
+        T fValue;
+
+        Node() : fNext(nullptr), fValue() {}
+        explicit Node(T&& value) : fNext(nullptr), fValue(std::move(value)) {}
+    };
+
+public:
+    MpscQueue()
+        : fHead(new Node())
+        , fTail(fHead.load())
+        , fPending(0)
+        , fProducers(0)
+    {
+    }
+
+    ~MpscQueue() {
+        // 値を繋いだ後の notify などで, まだ this に触っている producer がいる.
+        while (fProducers.load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+        T value;
+        while (tryPop(value)) {
+        }
+        delete fTail;
+    }
+
+    MpscQueue(MpscQueue const&) = delete;
+    MpscQueue& operator=(MpscQueue const&) = delete;
+
+    void push(T value) {
+        fProducers.fetch_add(1, std::memory_order_relaxed);
+        Node* node = new Node(std::move(value));
+        // 値が見える前に数えておく. 後だと consumer の fetch_sub が先に来て 0 を下回る.
+        fPending.fetch_add(1, std::memory_order_release);
+        Node* prev = fHead.exchange(node, std::memory_order_acq_rel);
+        prev->fNext.store(node, std::memory_order_release);
+        fPending.notify_one();
+        // これ以降は this に触らない.
+        fProducers.fetch_sub(1, std::memory_order_release);
+    }
+
+    bool tryPop(T& out) {
+        Node* tail = fTail;
+        Node* next = tail->fNext.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        out = std::move(next->fValue);
+        fTail = next;
+        delete tail;
+        fPending.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // consumer スレッドからのみ呼ぶ.
+    T pop() {
+        T value;
+        while (true) {
+            uint32_t const pending = fPending.load(std::memory_order_acquire);
+            if (pending == 0) {
+                fPending.wait(0, std::memory_order_acquire);
+                continue;
+            }
+            if (tryPop(value)) {
+                return value;
+            }
+            // producer が数えてから next を繋ぐまでの僅かな間.
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    std::atomic<Node*> fHead;
+    Node* fTail;
+    std::atomic<uint32_t> fPending;
+    // push の途中の producer の数
+    std::atomic<uint32_t> fProducers;
+};
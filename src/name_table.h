@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 名前に通し番号を振る. 番号は 1 から順に振り, 0 は「無し」に使う. 複数のスレッドから呼んでよい.
+class NameTable {
+public:
+    // 番号を使い切った場合は 0 を返す.
+    uint16_t intern(std::string const& name) {
+        std::lock_guard<std::mutex> lock(fMutex);
+        if (auto found = fIds.find(name); found != fIds.end()) {
+            return found->second;
+        }
+        if (fNames.size() >= UINT16_MAX) {
+            return 0;
+        }
+        fNames.push_back(name);
+        uint16_t const id = (uint16_t)fNames.size();
+        fIds[name] = id;
+        return id;
+    }
+
+    // names()[id - 1] が id の名前.
+    std::vector<std::string> names() const {
+        std::lock_guard<std::mutex> lock(fMutex);
+        return fNames;
+    }
+
+private:
+    mutable std::mutex fMutex;
+    std::unordered_map<std::string, uint16_t> fIds;
+    std::vector<std::string> fNames;
+};
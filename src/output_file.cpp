@@ -0,0 +1,145 @@
+#include "output_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+// path の隣に 0666 (umask が適用される) で一時ファイルを作る. mkstemp は 0600 で作ってしまうので使わない.
+static int CreateTemporary(string const& path, string& tmp) {
+    static atomic<uint64_t> sCounter(0);
+    for (int attempt = 0; attempt < 100; attempt++) {
+        uint64_t const n = sCounter.fetch_add(1) ^ ((uint64_t)chrono::steady_clock::now().time_since_epoch().count() << 16);
+        char suffix[48];
+        snprintf(suffix, sizeof(suffix), ".tmp.%d.%llx", (int)getpid(), (unsigned long long)n);
+        tmp = path + suffix;
+        int const fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd >= 0 || errno != EEXIST) {
+            return fd;
+        }
+    }
+    return -1;
+}
+
+// rename をディスクに残すため, 置き換えたファイルのディレクトリを fsync する.
+static bool SyncParentDirectory(string const& path, string& error) {
+    string directory = path;
+    if (size_t const slash = directory.rfind('/'); slash == string::npos) {
+        directory = ".";
+    } else {
+        directory.resize(slash == 0 ? 1 : slash);
+    }
+    int const fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        error = "open " + directory + ": " + strerror(errno);
+        return false;
+    }
+    bool const ok = fsync(fd) == 0;
+    if (!ok) {
+        error = "fsync " + directory + ": " + strerror(errno);
+    }
+    close(fd);
+    return ok;
+}
+
+bool WriteFileAtomically(string const& path, void const* data, size_t size, string& error) {
+    string tmp;
+    int const fd = CreateTemporary(path, tmp);
+    if (fd < 0) {
+        error = "create " + tmp + ": " + strerror(errno);
+        return false;
+    }
+
+    char const* p = (char const*)data;
+    size_t remaining = size;
+    while (remaining > 0) {
+        ssize_t const written = write(fd, p, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = "write " + tmp + ": " + strerror(errno);
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        p += written;
+        remaining -= written;
+    }
+    // 中身より先に rename がディスクに届くと, クラッシュ後に空のファイルが残る.
+    if (fsync(fd) != 0) {
+        error = "fsync " + tmp + ": " + strerror(errno);
+        close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+    if (close(fd) != 0) {
+        error = "close " + tmp + ": " + strerror(errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        error = "rename " + path + ": " + strerror(errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+    return SyncParentDirectory(path, error);
+}
+
+static uint64_t Mix(uint64_t v) {
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    v *= 0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33;
+    return v;
+}
+
+uint64_t HashPixels(uint32_t const* pixels, size_t count, uint64_t seed) {
+    uint64_t const kPrime = 0x9e3779b97f4a7c15ULL;
+    // 依存関係が連鎖しないように 4 系統に分けて混ぜる.
+    uint64_t lanes[4] = {seed, seed + kPrime, seed ^ (kPrime << 1), seed - kPrime};
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        for (int j = 0; j < 4; j++) {
+            uint64_t const v = (uint64_t)pixels[i + j * 2] | ((uint64_t)pixels[i + j * 2 + 1] << 32);
+            lanes[j] = (lanes[j] ^ Mix(v)) * kPrime;
+        }
+    }
+    uint64_t h = Mix(count);
+    for (; i < count; i++) {
+        h = (h ^ Mix(pixels[i])) * kPrime;
+    }
+    for (uint64_t lane : lanes) {
+        h = Mix(h ^ lane);
+    }
+    return h;
+}
+
+bool ReadSidecarHash(string const& path, uint64_t& hash) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) {
+        return false;
+    }
+    unsigned long long v = 0;
+    bool const ok = fscanf(file, "%16llx", &v) == 1;
+    fclose(file);
+    if (ok) {
+        hash = v;
+    }
+    return ok;
+}
+
+bool WriteSidecarHash(string const& path, uint64_t hash, string& error) {
+    char buffer[32];
+    int const length = snprintf(buffer, sizeof(buffer), "%016llx\n", (unsigned long long)hash);
+    return WriteFileAtomically(path, buffer, length, error);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 同じディレクトリの一時ファイルに書き込んでから rename で置き換える. 読み手が書きかけの
+// ファイルを見ることは無く, 戻った時点で中身と rename は fsync 済み. 権限は umask に従う.
+// 失敗した場合は error に理由を入れて false を返す.
+bool WriteFileAtomically(std::string const& path, void const* data, size_t size, std::string& error);
+
+// 出力する画素列のハッシュ. 暗号学的な強度は無いが, 変化の検出には十分.
+uint64_t HashPixels(uint32_t const* pixels, size_t count, uint64_t seed);
+
+// 画像の隣に置くハッシュ値のファイル (16 進数 1 行).
+bool ReadSidecarHash(std::string const& path, uint64_t& hash);
+bool WriteSidecarHash(std::string const& path, uint64_t hash, std::string& error);
@@ -0,0 +1,253 @@
+#include "perf_counters.h"
+
+#include <atomic>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace {
+
+int const kEventCount = 4;
+// read で返す値の数. 末尾は有効だった時間と実際に数えていた時間.
+int const kValueCount = kEventCount + 2;
+int const kTimeEnabled = kEventCount;
+int const kTimeRunning = kEventCount + 1;
+
+char const* const kEventNames[kEventCount] = {
+    "cycles",
+    "instructions",
+    "cache-misses",
+    "branch-misses",
+};
+
+char const* const kStageNames[kPerfStageCount] = {
+    "chunk decode",
+    "column scan",
+    "shading",
+    "encode",
+};
+
+struct WorkerCounters {
+    int fWorker;
+    uint64_t fCalls[kPerfStageCount] = {};
+    uint64_t fValues[kPerfStageCount][kValueCount] = {};
+};
+
+std::atomic_bool sEnabled(false);
+std::atomic_bool sWarned(false);
+std::mutex sMutex;
+std::vector<std::shared_ptr<WorkerCounters>> sWorkers;
+
+#if defined(__linux__)
+
+uint64_t const kEventConfigs[kEventCount] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+int OpenEvent(uint64_t config, int group) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = group < 0 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // 他のプロセスとカウンタを取り合うと多重化されるので, 補正のために時間も読む.
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+class ThreadCounters {
+public:
+    ThreadCounters() {
+        for (int i = 0; i < kEventCount; i++) {
+            fFds[i] = -1;
+            fSlot[i] = -1;
+        }
+        int const leader = OpenEvent(kEventConfigs[0], -1);
+        if (leader < 0) {
+            Warn(errno);
+            return;
+        }
+        fFds[0] = leader;
+        fSlot[0] = 0;
+        int slots = 1;
+        // cycles 以外はサポートされていなければ 0 のまま集計する.
+        for (int i = 1; i < kEventCount; i++) {
+            int const fd = OpenEvent(kEventConfigs[i], leader);
+            if (fd < 0) {
+                continue;
+            }
+            fFds[i] = fd;
+            fSlot[i] = slots++;
+        }
+        fSlots = slots;
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+        fStats = std::make_shared<WorkerCounters>();
+        std::lock_guard<std::mutex> lock(sMutex);
+        fStats->fWorker = (int)sWorkers.size();
+        sWorkers.push_back(fStats);
+    }
+
+    ~ThreadCounters() {
+        for (int i = 0; i < kEventCount; i++) {
+            if (fFds[i] >= 0) {
+                close(fFds[i]);
+            }
+        }
+    }
+
+    bool available() const {
+        return fStats != nullptr;
+    }
+
+    bool read(uint64_t out[kValueCount]) const {
+        // nr, time_enabled, time_running, 各カウンタの値
+        uint64_t buffer[3 + kEventCount];
+        ssize_t const size = (ssize_t)(sizeof(uint64_t) * (3 + fSlots));
+        if (::read(fFds[0], buffer, size) != size) {
+            return false;
+        }
+        for (int i = 0; i < kEventCount; i++) {
+            out[i] = fSlot[i] < 0 ? 0 : buffer[3 + fSlot[i]];
+        }
+        out[kTimeEnabled] = buffer[1];
+        out[kTimeRunning] = buffer[2];
+        return true;
+    }
+
+    void add(PerfStage stage, uint64_t const begin[kValueCount], uint64_t const end[kValueCount]) {
+        int const s = (int)stage;
+        fStats->fCalls[s]++;
+        for (int i = 0; i < kValueCount; i++) {
+            fStats->fValues[s][i] += end[i] - begin[i];
+        }
+    }
+
+private:
+    static void Warn(int error) {
+        if (sWarned.exchange(true)) {
+            return;
+        }
+        fprintf(stderr, "perf_event_open failed: %s; hardware counters are disabled\n", strerror(error));
+    }
+
+private:
+    int fFds[kEventCount];
+    int fSlot[kEventCount];
+    int fSlots = 0;
+    std::shared_ptr<WorkerCounters> fStats;
+};
+
+ThreadCounters& CurrentThreadCounters() {
+    thread_local ThreadCounters counters;
+    return counters;
+}
+
+#endif
+
+} // namespace
+
+void PerfCounters::SetEnabled(bool enabled) {
+#if defined(__linux__)
+    sEnabled = enabled;
+#else
+    if (enabled && !sWarned.exchange(true)) {
+        fprintf(stderr, "hardware counters are only supported on Linux\n");
+    }
+#endif
+}
+
+bool PerfCounters::IsEnabled() {
+    return sEnabled.load(std::memory_order_relaxed);
+}
+
+void PerfCounters::Report(std::ostream& out) {
+    if (!IsEnabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(sMutex);
+    if (sWorkers.empty()) {
+        return;
+    }
+    WorkerCounters total;
+    total.fWorker = -1;
+    auto print = [&out](std::string const& label, WorkerCounters const& w) {
+        for (int s = 0; s < kPerfStageCount; s++) {
+            if (w.fCalls[s] == 0) {
+                continue;
+            }
+            // グループ内のカウンタは同時に数えられるので, 補正の割合は全て同じ. ipc は補正の影響を受けない.
+            uint64_t const enabled = w.fValues[s][kTimeEnabled];
+            uint64_t const running = w.fValues[s][kTimeRunning];
+            double const scale = running > 0 ? (double)enabled / running : 0;
+            uint64_t const cycles = w.fValues[s][0];
+            uint64_t const instructions = w.fValues[s][1];
+            double const ipc = cycles > 0 ? (double)instructions / cycles : 0;
+            out << std::setw(10) << label << std::setw(14) << kStageNames[s]
+                << "  calls=" << w.fCalls[s]
+                << " ipc=" << std::fixed << std::setprecision(2) << ipc
+                << " running=" << std::setprecision(1) << (enabled > 0 ? 100.0 * running / enabled : 0) << "%";
+            for (int i = 0; i < kEventCount; i++) {
+                out << " " << kEventNames[i] << "=" << (uint64_t)(w.fValues[s][i] * scale + 0.5);
+            }
+            out << std::endl;
+        }
+    };
+    for (auto const& w : sWorkers) {
+        for (int s = 0; s < kPerfStageCount; s++) {
+            total.fCalls[s] += w->fCalls[s];
+            for (int i = 0; i < kValueCount; i++) {
+                total.fValues[s][i] += w->fValues[s][i];
+            }
+        }
+        print("worker " + std::to_string(w->fWorker), *w);
+    }
+    print("total", total);
+}
+
+PerfScope::PerfScope(PerfStage stage)
+    : fStage(stage)
+    , fActive(false)
+{
+#if defined(__linux__)
+    if (!PerfCounters::IsEnabled()) {
+        return;
+    }
+    auto& counters = CurrentThreadCounters();
+    if (!counters.available()) {
+        return;
+    }
+    fActive = counters.read(fBegin);
+#endif
+}
+
+PerfScope::~PerfScope() {
+#if defined(__linux__)
+    if (!fActive) {
+        return;
+    }
+    auto& counters = CurrentThreadCounters();
+    uint64_t end[kValueCount];
+    if (counters.read(end)) {
+        counters.add(fStage, fBegin, end);
+    }
+#endif
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+enum class PerfStage : int {
+    ChunkDecode = 0,
+    ColumnScan,
+    Shading,
+    Encode,
+};
+
+int const kPerfStageCount = 4;
+
+// Linux の perf_event_open を使ってステージ毎にハードウェアカウンタを集計する.
+// カウンタが多重化されていた場合は, 数えていた時間の割合で補正した値を出す.
+// カウンタが利用できない環境では何もしない.
+class PerfCounters {
+    PerfCounters() = delete;
+
+public:
+    static void SetEnabled(bool enabled);
+    static bool IsEnabled();
+    static void Report(std::ostream& out);
+};
+
+class PerfScope {
+public:
+    explicit PerfScope(PerfStage stage);
+    ~PerfScope();
+
+    PerfScope(PerfScope const&) = delete;
+    PerfScope& operator=(PerfScope const&) = delete;
+
+private:
+    PerfStage const fStage;
+    bool fActive;
+    // カウンタ 4 つと, グループが有効だった時間・実際に数えていた時間
+    uint64_t fBegin[4 + 2];
+};
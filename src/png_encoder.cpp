@@ -0,0 +1,189 @@
+#include "png_encoder.h"
+#include "perf_counters.h"
+#include "alloc_profiler.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+
+using namespace std;
+
+namespace {
+
+int const kRowsPerBand = 64;
+int const kWindowSize = 32 * 1024;
+
+struct Band {
+    int row0;
+    int row1;
+    vector<uint8_t> filtered;
+    vector<uint8_t> compressed;
+    uLong adler;
+};
+
+uint8_t Paeth(int a, int b, int c) {
+    int const p = a + b - c;
+    int const pa = abs(p - a);
+    int const pb = abs(p - b);
+    int const pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return (uint8_t)a;
+    } else if (pb <= pc) {
+        return (uint8_t)b;
+    } else {
+        return (uint8_t)c;
+    }
+}
+
+// lodepng の既定と同じく, 符号付きとみなした絶対値の和が最小になるフィルタを行毎に選ぶ.
+void FilterRow(uint8_t const* row, uint8_t const* prev, size_t stride, uint8_t* out) {
+    int const bpp = 4;
+    thread_local vector<uint8_t> attempt;
+    attempt.resize(stride);
+    size_t bestSum = SIZE_MAX;
+    for (int type = 0; type < 5; type++) {
+        for (size_t i = 0; i < stride; i++) {
+            int const a = i >= bpp ? row[i - bpp] : 0;
+            int const b = prev ? prev[i] : 0;
+            int const c = i >= bpp && prev ? prev[i - bpp] : 0;
+            int predictor = 0;
+            switch (type) {
+                case 1: predictor = a; break;
+                case 2: predictor = b; break;
+                case 3: predictor = (a + b) / 2; break;
+                case 4: predictor = Paeth(a, b, c); break;
+                default: break;
+            }
+            attempt[i] = (uint8_t)(row[i] - predictor);
+        }
+        size_t sum = 0;
+        for (size_t i = 0; i < stride; i++) {
+            uint8_t const s = attempt[i];
+            sum += type == 0 ? s : (s < 128 ? s : 255 - s);
+        }
+        if (sum < bestSum) {
+            bestSum = sum;
+            out[0] = (uint8_t)type;
+            copy_n(attempt.data(), stride, out + 1);
+        }
+    }
+}
+
+void FilterBand(uint8_t const* pixels, size_t stride, Band& band) {
+    PerfScope scope(PerfStage::Encode);
+    AllocScope allocScope(AllocStage::Encode);
+    band.filtered.resize((stride + 1) * (band.row1 - band.row0));
+    for (int y = band.row0; y < band.row1; y++) {
+        uint8_t const* row = pixels + stride * y;
+        uint8_t const* prev = y > 0 ? row - stride : nullptr;
+        FilterRow(row, prev, stride, band.filtered.data() + (stride + 1) * (y - band.row0));
+    }
+    band.adler = adler32(adler32(0, nullptr, 0), band.filtered.data(), (uInt)band.filtered.size());
+}
+
+// 前の帯の末尾を辞書にして圧縮する. 最後以外の帯は sync flush でバイト境界に揃えて終える.
+bool CompressBand(Band const* previous, bool last, Band& band) {
+    PerfScope scope(PerfStage::Encode);
+    AllocScope allocScope(AllocStage::Encode);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    if (previous) {
+        size_t const length = min(previous->filtered.size(), (size_t)kWindowSize);
+        deflateSetDictionary(&stream, previous->filtered.data() + previous->filtered.size() - length, (uInt)length);
+    }
+    band.compressed.resize(deflateBound(&stream, (uLong)band.filtered.size()) + 16);
+    stream.next_in = const_cast<Bytef*>(band.filtered.data());
+    stream.avail_in = (uInt)band.filtered.size();
+    stream.next_out = band.compressed.data();
+    stream.avail_out = (uInt)band.compressed.size();
+    int const ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    band.compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    return last ? ret == Z_STREAM_END : (ret == Z_OK && stream.avail_in == 0);
+}
+
+void Append32(vector<uint8_t>& out, uint32_t v) {
+    out.push_back((uint8_t)(v >> 24));
+    out.push_back((uint8_t)(v >> 16));
+    out.push_back((uint8_t)(v >> 8));
+    out.push_back((uint8_t)v);
+}
+
+void AppendChunk(vector<uint8_t>& out, char const* type, vector<uint8_t> const& data) {
+    Append32(out, (uint32_t)data.size());
+    size_t const start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    Append32(out, (uint32_t)crc32(0, out.data() + start, (uInt)(out.size() - start)));
+}
+
+} // namespace
+
+bool EncodePngParallel(uint32_t const* rgba, int width, int height, hwm::task_queue& pool, vector<uint8_t>& out) {
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+    uint8_t const* pixels = (uint8_t const*)rgba;
+    size_t const stride = (size_t)width * 4;
+
+    vector<Band> bands;
+    for (int y = 0; y < height; y += kRowsPerBand) {
+        bands.push_back({y, min(y + kRowsPerBand, height), {}, {}, 0});
+    }
+
+    vector<future<void>> filtered;
+    for (auto& band : bands) {
+        filtered.push_back(pool.enqueue([pixels, stride, &band]() {
+            FilterBand(pixels, stride, band);
+        }));
+    }
+    for (auto& f : filtered) {
+        f.get();
+    }
+
+    vector<future<bool>> compressed;
+    for (size_t i = 0; i < bands.size(); i++) {
+        Band const* previous = i > 0 ? &bands[i - 1] : nullptr;
+        bool const last = i + 1 == bands.size();
+        compressed.push_back(pool.enqueue([previous, last, &band = bands[i]]() {
+            return CompressBand(previous, last, band);
+        }));
+    }
+    bool ok = true;
+    for (auto& f : compressed) {
+        ok = f.get() && ok;
+    }
+    if (!ok) {
+        return false;
+    }
+
+    vector<uint8_t> idat = {0x78, 0x9c};
+    uLong adler = adler32(0, nullptr, 0);
+    for (auto const& band : bands) {
+        idat.insert(idat.end(), band.compressed.begin(), band.compressed.end());
+        adler = adler32_combine(adler, band.adler, (z_off_t)band.filtered.size());
+    }
+    Append32(idat, (uint32_t)adler);
+
+    vector<uint8_t> ihdr;
+    Append32(ihdr, (uint32_t)width);
+    Append32(ihdr, (uint32_t)height);
+    ihdr.push_back(8); // bit depth
+    ihdr.push_back(6); // RGBA
+    ihdr.push_back(0);
+    ihdr.push_back(0);
+    ihdr.push_back(0);
+
+    static uint8_t const kSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    out.assign(kSignature, kSignature + sizeof(kSignature));
+    AppendChunk(out, "IHDR", ihdr);
+    AppendChunk(out, "IDAT", idat);
+    AppendChunk(out, "IEND", {});
+    return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <hwm/task/task_queue.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// RGBA 8bit の画像を PNG にする. 行のフィルタと deflate は横長の帯毎に pool で並列に行い,
+// 各帯の圧縮結果をつないで 1 つの zlib ストリームにする (Adler-32 は帯毎の値を合成する).
+// pool のワーカーから呼んではいけない.
+bool EncodePngParallel(uint32_t const* rgba, int width, int height, hwm::task_queue& pool, std::vector<uint8_t>& out);
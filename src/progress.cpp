@@ -0,0 +1,186 @@
+#include "progress.h"
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+// レイテンシのヒストグラムは 2^(1/4) 倍刻みのミリ秒単位.
+int LatencyBucket(uint64_t millis) {
+    int bucket = (int)floor(4 * log2((double)millis + 1));
+    return min(max(bucket, 0), 63);
+}
+
+double LatencyBucketUpperBoundSeconds(int bucket) {
+    return (pow(2.0, (bucket + 1) / 4.0) - 1) / 1000.0;
+}
+
+string FormatDuration(double seconds) {
+    long const total = (long)seconds;
+    ostringstream ss;
+    ss << setfill('0') << setw(2) << total / 3600 << ":" << setw(2) << (total / 60) % 60 << ":" << setw(2) << total % 60;
+    return ss.str();
+}
+
+string EscapeJson(string const& s) {
+    ostringstream ss;
+    for (char c : s) {
+        switch (c) {
+            case '"':
+                ss << "\\\"";
+                break;
+            case '\\':
+                ss << "\\\\";
+                break;
+            case '\n':
+                ss << "\\n";
+                break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    ss << "\\u" << hex << setw(4) << setfill('0') << (int)c << dec;
+                } else {
+                    ss << c;
+                }
+                break;
+        }
+    }
+    return ss.str();
+}
+
+} // namespace
+
+Progress::Progress(int regionsTotal, string const& errorLogFile)
+    : fRegionsTotal(regionsTotal)
+    , fStarted(chrono::steady_clock::now())
+    , fRegionsDone(0)
+    , fChunksTotal(0)
+    , fChunksDone(0)
+    , fBytesRead(0)
+    , fErrors(0)
+    , fLatencySumMillis(0)
+    , fStop(false)
+{
+    for (int i = 0; i < kLatencyBuckets; i++) {
+        fLatency[i] = 0;
+    }
+    if (!errorLogFile.empty()) {
+        fErrorLog.open(errorLogFile, ios::out | ios::app);
+        if (!fErrorLog) {
+            cerr << "cannot open error log: " << errorLogFile << endl;
+        }
+    }
+}
+
+Progress::~Progress() {
+    stop();
+}
+
+void Progress::start(double intervalSeconds) {
+    if (intervalSeconds <= 0 || fThread.joinable()) {
+        return;
+    }
+    fThread = thread([this, intervalSeconds]() { run(intervalSeconds); });
+}
+
+void Progress::stop() {
+    if (!fThread.joinable()) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(fMutex);
+        fStop = true;
+    }
+    fCv.notify_all();
+    fThread.join();
+    print(true);
+}
+
+void Progress::regionDone(chrono::steady_clock::duration elapsed) {
+    uint64_t const millis = (uint64_t)chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+    fLatency[LatencyBucket(millis)].fetch_add(1, memory_order_relaxed);
+    fLatencySumMillis.fetch_add(millis, memory_order_relaxed);
+    fRegionsDone.fetch_add(1, memory_order_relaxed);
+}
+
+void Progress::error(int regionX, int regionZ, string const& stage, string const& message) {
+    fErrors.fetch_add(1);
+    lock_guard<mutex> lock(fErrorMutex);
+    cerr << "r." << regionX << "." << regionZ << ": " << stage << ": " << message << endl;
+    if (fErrorLog) {
+        auto const now = chrono::system_clock::to_time_t(chrono::system_clock::now());
+        fErrorLog << "{\"time\":" << now
+                  << ",\"region\":[" << regionX << "," << regionZ << "]"
+                  << ",\"stage\":\"" << EscapeJson(stage) << "\""
+                  << ",\"message\":\"" << EscapeJson(message) << "\"}" << endl;
+    }
+}
+
+void Progress::run(double intervalSeconds) {
+    auto const interval = chrono::duration<double>(intervalSeconds);
+    unique_lock<mutex> lock(fMutex);
+    while (!fCv.wait_for(lock, interval, [this]() { return fStop; })) {
+        print(false);
+    }
+}
+
+double Progress::percentileSeconds(double p) const {
+    uint64_t total = 0;
+    uint32_t counts[kLatencyBuckets];
+    for (int i = 0; i < kLatencyBuckets; i++) {
+        counts[i] = fLatency[i].load(memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t const threshold = (uint64_t)ceil(total * p);
+    uint64_t sum = 0;
+    for (int i = 0; i < kLatencyBuckets; i++) {
+        sum += counts[i];
+        if (sum >= threshold) {
+            return LatencyBucketUpperBoundSeconds(i);
+        }
+    }
+    return LatencyBucketUpperBoundSeconds(kLatencyBuckets - 1);
+}
+
+void Progress::print(bool final) {
+    double const elapsed = chrono::duration<double>(chrono::steady_clock::now() - fStarted).count();
+    int const regionsTotal = fRegionsTotal.load(memory_order_relaxed);
+    int const regionsDone = fRegionsDone.load(memory_order_relaxed);
+    int const chunksDone = fChunksDone.load(memory_order_relaxed);
+    int const chunksTotal = fChunksTotal.load(memory_order_relaxed);
+    uint64_t const bytes = fBytesRead.load(memory_order_relaxed);
+
+    double ratio = regionsTotal > 0 ? (double)regionsDone / regionsTotal : 0;
+    if (regionsDone == 0 && chunksTotal > 0 && regionsTotal > 0) {
+        // 最初のリージョンが終わるまではチャンク単位の進捗で見積もる.
+        ratio = (double)chunksDone / chunksTotal / regionsTotal;
+    }
+
+    ostringstream ss;
+    ss << fixed << setprecision(1)
+       << (final ? "[done] " : "[progress] ")
+       << "regions " << regionsDone << "/" << regionsTotal
+       << ", chunks " << chunksDone << "/" << chunksTotal
+       << ", " << (elapsed > 0 ? chunksDone / elapsed : 0) << " chunks/s"
+       << ", " << (elapsed > 0 ? bytes / elapsed / (1024 * 1024) : 0) << " MB/s";
+    if (regionsDone > 0) {
+        ss << ", region avg " << fLatencySumMillis.load(memory_order_relaxed) / 1000.0 / regionsDone << "s"
+           << " p95 " << percentileSeconds(0.95) << "s";
+    }
+    int const errors = fErrors.load(memory_order_relaxed);
+    if (errors > 0) {
+        ss << ", errors " << errors;
+    }
+    if (final) {
+        ss << ", elapsed " << FormatDuration(elapsed);
+    } else if (ratio > 0) {
+        ss << ", ETA " << FormatDuration(elapsed * (1 - ratio) / ratio);
+    }
+    cerr << ss.str() << endl;
+}
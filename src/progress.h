@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// ワーカーからは atomic 変数の更新だけを行い, 集計と出力は専用のスレッドで定期的に行う.
+class Progress {
+public:
+    Progress(int regionsTotal, std::string const& errorLogFile);
+    ~Progress();
+
+    Progress(Progress const&) = delete;
+    Progress& operator=(Progress const&) = delete;
+
+    void start(double intervalSeconds);
+    void stop();
+
+    void addRegions(int count) {
+        fRegionsTotal.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void addChunks(int count) {
+        fChunksTotal.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void chunkDone(uint64_t bytesRead) {
+        fChunksDone.fetch_add(1, std::memory_order_relaxed);
+        fBytesRead.fetch_add(bytesRead, std::memory_order_relaxed);
+    }
+
+    void regionDone(std::chrono::steady_clock::duration elapsed);
+    void error(int regionX, int regionZ, std::string const& stage, std::string const& message);
+
+    int errors() const {
+        return fErrors.load();
+    }
+
+private:
+    void run(double intervalSeconds);
+    void print(bool final);
+    double percentileSeconds(double p) const;
+
+private:
+    static int const kLatencyBuckets = 64;
+
+    std::atomic<int> fRegionsTotal;
+    std::chrono::steady_clock::time_point const fStarted;
+
+    std::atomic<int> fRegionsDone;
+    std::atomic<int> fChunksTotal;
+    std::atomic<int> fChunksDone;
+    std::atomic<uint64_t> fBytesRead;
+    std::atomic<int> fErrors;
+    std::atomic<uint64_t> fLatencySumMillis;
+    std::atomic<uint32_t> fLatency[kLatencyBuckets];
+
+    std::mutex fErrorMutex;
+    std::ofstream fErrorLog;
+
+    std::mutex fMutex;
+    std::condition_variable fCv;
+    bool fStop;
+    std::thread fThread;
+};
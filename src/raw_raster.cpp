@@ -0,0 +1,36 @@
+#include "raw_raster.h"
+
+#include <string.h>
+
+#include <bit>
+
+using namespace std;
+
+static_assert(endian::native == endian::little, "raw raster is written in host byte order");
+
+static uint64_t Align(uint64_t offset) {
+    return (offset + kRawRasterAlignment - 1) / kRawRasterAlignment * kRawRasterAlignment;
+}
+
+void EncodeRawRaster(uint32_t const* rgba, int16_t const* altitude, int width, int height, int originX, int originZ, int scale, vector<unsigned char>& out) {
+    uint64_t const pixels = (uint64_t)width * (uint64_t)height;
+    RawRasterHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MCA2RAW", 8);
+    header.version = kRawRasterVersion;
+    header.headerSize = sizeof(RawRasterHeader);
+    header.width = width;
+    header.height = height;
+    header.originX = originX;
+    header.originZ = originZ;
+    header.scale = scale;
+    header.rgbaOffset = Align(sizeof(RawRasterHeader));
+    header.altitudeOffset = Align(header.rgbaOffset + pixels * sizeof(uint32_t));
+    uint64_t const size = Align(header.altitudeOffset + pixels * sizeof(int16_t));
+
+    // 境界合わせの隙間は 0 で埋める.
+    out.assign(size, 0);
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + header.rgbaOffset, rgba, pixels * sizeof(uint32_t));
+    memcpy(out.data() + header.altitudeOffset, altitude, pixels * sizeof(int16_t));
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// 他のツールが mmap してそのまま読めるラスタの形式 (*.raw). 全てリトルエンディアンで,
+// 先頭の 64 バイトがヘッダー, 続いて各セクションを 64 バイト境界から置く.
+//   rgba:     width * height 個の RGBA8 (R が先頭のバイト), 行優先
+//   altitude: width * height 個の int16 (最上部の不透明なブロックの y), 行優先
+// 画素 (x, z) はブロック座標の (originX + x * scale, originZ + z * scale) に当たる.
+struct RawRasterHeader {
+    // "MCA2RAW" と 0
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    int32_t width;
+    int32_t height;
+    int32_t originX;
+    int32_t originZ;
+    int32_t scale;
+    uint32_t reserved0;
+    // ファイルの先頭からのオフセット
+    uint64_t rgbaOffset;
+    uint64_t altitudeOffset;
+    uint64_t reserved1;
+};
+static_assert(sizeof(RawRasterHeader) == 64, "RawRasterHeader must be 64 bytes");
+
+uint32_t const kRawRasterVersion = 1;
+uint64_t const kRawRasterAlignment = 64;
+
+// リトルエンディアンの環境でだけ使える.
+void EncodeRawRaster(uint32_t const* rgba, int16_t const* altitude, int width, int height, int originX, int originZ, int scale, std::vector<unsigned char>& out);
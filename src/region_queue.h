@@ -0,0 +1,115 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <utility>
+#include <vector>
+
+// 再描画を待っているリージョンのキュー. 同じリージョンは 1 度だけ入る.
+// チャンクが直接変更されたものを, 境界の高度だけが変わったものより先に, それぞれ古い順に取り出す.
+// 取り出したリージョンは done を呼ぶまで描画中として扱い, その間に来た変更は描画が終わってから入れ直す.
+class RegionQueue {
+public:
+    // 新たにキューに入った場合は true. 既に入っていた場合は必要なら優先度だけ上げる.
+    bool push(std::pair<int, int> region, bool direct) {
+        bool added;
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            if (fRunning.count(region) > 0) {
+                // 描画中のものと並行して描かないよう, 終わるまで取っておく.
+                auto [pending, inserted] = fPending.emplace(region, direct);
+                pending->second = pending->second || direct;
+                return inserted;
+            }
+            auto found = fQueued.find(region);
+            added = found == fQueued.end();
+            if (!added && (!direct || found->second.direct)) {
+                return false;
+            }
+            enqueue(region, direct);
+        }
+        fCv.notify_one();
+        return added;
+    }
+
+    // close された場合は false.
+    bool pop(std::pair<int, int>& region) {
+        std::unique_lock<std::mutex> lock(fMutex);
+        while (true) {
+            fCv.wait(lock, [this]() { return fClosed || !fEntries.empty(); });
+            if (fClosed) {
+                return false;
+            }
+            Entry const entry = fEntries.top();
+            fEntries.pop();
+            auto found = fQueued.find(entry.region);
+            if (found == fQueued.end() || found->second.sequence != entry.sequence) {
+                continue;
+            }
+            fQueued.erase(found);
+            fRunning.insert(entry.region);
+            region = entry.region;
+            return true;
+        }
+    }
+
+    // pop で取り出したリージョンの描画が終わった.
+    void done(std::pair<int, int> region) {
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fRunning.erase(region);
+            auto pending = fPending.find(region);
+            if (pending == fPending.end()) {
+                return;
+            }
+            enqueue(region, pending->second);
+            fPending.erase(pending);
+        }
+        fCv.notify_one();
+    }
+
+    // 待っている pop を全て false で戻す.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fClosed = true;
+        }
+        fCv.notify_all();
+    }
+
+private:
+    struct Entry {
+        bool direct;
+        uint64_t sequence;
+        std::pair<int, int> region;
+
+        // priority_queue は最大のものを先頭にするので, 優先するものほど大きくなるよう比較する.
+        bool operator<(Entry const& other) const {
+            if (direct != other.direct) {
+                return !direct;
+            }
+            return sequence > other.sequence;
+        }
+    };
+
+    // 優先度を上げる場合は入れ直し, 古い項目は取り出す時に読み飛ばす.
+    void enqueue(std::pair<int, int> region, bool direct) {
+        Entry entry{direct, fSequence++, region};
+        fQueued[region] = entry;
+        fEntries.push(entry);
+    }
+
+    std::mutex fMutex;
+    std::condition_variable fCv;
+    std::priority_queue<Entry> fEntries;
+    std::map<std::pair<int, int>, Entry> fQueued;
+    // 描画中のリージョンと, その間に変更されたもの (値は direct)
+    std::set<std::pair<int, int>> fRunning;
+    std::map<std::pair<int, int>, bool> fPending;
+    bool fClosed = false;
+    uint64_t fSequence = 0;
+};
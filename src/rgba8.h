@@ -0,0 +1,200 @@
+#pragma once
+
+#include "color.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// 乗算済みアルファの RGBA 8bit 色. float の Color は参照実装として残している.
+struct Rgba8 {
+    uint8_t fR;
+    uint8_t fG;
+    uint8_t fB;
+    uint8_t fA;
+
+    bool operator==(Rgba8 const&) const = default;
+
+    // v / 255 を丸めた値. v は 255 * 255 以下.
+    static constexpr uint8_t Div255(uint32_t v) {
+        v += 128;
+        return (uint8_t)((v + (v >> 8)) >> 8);
+    }
+
+    static constexpr Rgba8 Make(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255) {
+        return Rgba8{Div255(r * a), Div255(g * a), Div255(b * a), a};
+    }
+
+    static Rgba8 FromColor(Color c) {
+        return Rgba8{ToU8(c.fR * c.fA), ToU8(c.fG * c.fA), ToU8(c.fB * c.fA), ToU8(c.fA)};
+    }
+
+    Color toColor() const {
+        if (fA == 0) {
+            return Color::FromFloat(0, 0, 0, 0);
+        }
+        float const a = fA / 255.f;
+        return Color::FromFloat(fR / 255.f / a, fG / 255.f / a, fB / 255.f / a, a);
+    }
+
+    static Rgba8 Blend(Rgba8 fg, Rgba8 bg) {
+        uint32_t const inv = 255 - fg.fA;
+        return Rgba8{
+            (uint8_t)(fg.fR + Div255(bg.fR * inv)),
+            (uint8_t)(fg.fG + Div255(bg.fG * inv)),
+            (uint8_t)(fg.fB + Div255(bg.fB * inv)),
+            (uint8_t)(fg.fA + Div255(bg.fA * inv)),
+        };
+    }
+
+    // Color::Add と同じく, 乗算済みの色を足して不透明にする.
+    static Rgba8 Add(Rgba8 a, Rgba8 b) {
+        return Rgba8{
+            Saturate(a.fR + b.fR),
+            Saturate(a.fG + b.fG),
+            Saturate(a.fB + b.fB),
+            255,
+        };
+    }
+
+    // 乗算済みでない RGBA を Color::color() と同じ並びで返す.
+    uint32_t color() const {
+        if (fA == 255 || fA == 0) {
+            return ((uint32_t)fA << 24) | ((uint32_t)fB << 16) | ((uint32_t)fG << 8) | (uint32_t)fR;
+        }
+        auto unpremultiply = [this](uint8_t v) {
+            return Saturate((v * 255 + fA / 2) / fA);
+        };
+        return ((uint32_t)fA << 24) | ((uint32_t)unpremultiply(fB) << 16) | ((uint32_t)unpremultiply(fG) << 8) | (uint32_t)unpremultiply(fR);
+    }
+
+private:
+    static constexpr uint8_t Saturate(uint32_t v) {
+        return v > 255 ? 255 : (uint8_t)v;
+    }
+
+    static uint8_t ToU8(float v) {
+        float const vv = v * 255;
+        if (vv <= 0) {
+            return 0;
+        } else if (255 <= vv) {
+            return 255;
+        } else {
+            return (uint8_t)lrintf(vv);
+        }
+    }
+};
+
+// HSV の V を定数倍してから RGB に戻す処理は, RGB の各成分を同じ倍率で拡大してから
+// 飽和させるのと等しい. 倍率が固定の場合に使う 8bit のテーブル.
+class BrightnessTable {
+public:
+    explicit BrightnessTable(float factor) {
+        for (int v = 0; v < 256; v++) {
+            fTable[v] = Scale(v, Factor(factor));
+        }
+    }
+
+    uint8_t operator[](uint8_t v) const {
+        return fTable[v];
+    }
+
+    // 倍率を 16bit 固定小数点にしたもの.
+    static uint32_t Factor(float factor) {
+        return factor <= 0 ? 0 : (uint32_t)lrintf(factor * 65536);
+    }
+
+    static uint8_t Scale(uint8_t v, uint32_t factor) {
+        uint32_t const scaled = (v * factor + 32768) >> 16;
+        return scaled > 255 ? 255 : (uint8_t)scaled;
+    }
+
+private:
+    uint8_t fTable[256];
+};
+
+// 最上部の不透明なブロックより上にある半透明な色を, 手前から奥へ順に積んだもの.
+// 8bit の Blend は途中で丸めるので結合的でなく, 1 色にまとめてから重ねると結果が変わる.
+// 元の実装と同じ結果にするため, 奥から手前へ 1 層ずつ Blend する. 同じ色が続く場合
+// (ガラスの柱など) はまとめて持ち, 層が少ない間は確保を伴わない.
+// 手前から積んだアルファが 255 に達し, 奥に何があっても結果が変わらなくなった後の層は記録しない.
+class TranslucentLayers {
+public:
+    void add(Rgba8 c) {
+        if (fSaturated) {
+            return;
+        }
+        fLayers++;
+        fCoverage = (uint8_t)(fCoverage + Rgba8::Div255(c.fA * (255u - fCoverage)));
+        push(c);
+        // 丸めのせいでアルファが 255 でも奥の色が 1 LSB 透けることがあるので, 実際に確かめる.
+        // 確かめる間隔を倍々にして, 長い柱でも 2 乗の手間にならないようにする.
+        if (fCoverage == 255 && fLayers >= fNextCheck) {
+            fSaturated = saturated();
+            fNextCheck = fLayers * 2;
+        }
+    }
+
+    Rgba8 over(Rgba8 base) const {
+        Rgba8 result = base;
+        for (size_t i = fCount; i > 0; i--) {
+            Run const& run = at(i - 1);
+            for (uint32_t k = 0; k < run.fRepeat; k++) {
+                Rgba8 const next = Rgba8::Blend(run.fColor, result);
+                // 同じ色を重ねても変わらなくなれば, 残りの繰り返しも結果を変えない.
+                if (next == result) {
+                    break;
+                }
+                result = next;
+            }
+        }
+        return result;
+    }
+
+private:
+    struct Run {
+        Rgba8 fColor;
+        uint32_t fRepeat;
+    };
+
+    static size_t const kInlineRuns = 4;
+
+    void push(Rgba8 c) {
+        if (fCount > 0) {
+            Run& last = at(fCount - 1);
+            if (last.fColor == c) {
+                last.fRepeat++;
+                return;
+            }
+        }
+        if (fCount < kInlineRuns) {
+            fInline[fCount] = Run{c, 1};
+        } else {
+            fOverflow.push_back(Run{c, 1});
+        }
+        fCount++;
+    }
+
+    // Blend は各成分について奥の値に単調なので, 両端で同じなら奥の値によらない.
+    bool saturated() const {
+        return over(Rgba8{0, 0, 0, 0}) == over(Rgba8{255, 255, 255, 255});
+    }
+
+    Run& at(size_t i) {
+        return i < kInlineRuns ? fInline[i] : fOverflow[i - kInlineRuns];
+    }
+
+    Run const& at(size_t i) const {
+        return i < kInlineRuns ? fInline[i] : fOverflow[i - kInlineRuns];
+    }
+
+private:
+    size_t fCount = 0;
+    Run fInline[kInlineRuns];
+    std::vector<Run> fOverflow;
+    // 手前から積んだアルファ
+    uint8_t fCoverage = 0;
+    bool fSaturated = false;
+    uint32_t fLayers = 0;
+    uint32_t fNextCheck = 0;
+};
@@ -0,0 +1,350 @@
+#include "tile_server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// 描画するものが無かったという結果もキャッシュするので, その分の大きさ.
+uint64_t const kEntryOverhead = 256;
+size_t const kMaxHeaderBytes = 16 * 1024;
+int const kIdleTimeoutSeconds = 30;
+// fd を使い切って予備も無い場合に, accept をやり直すまでの間隔.
+int const kAcceptBackoffMilliseconds = 100;
+
+bool SendAll(int fd, char const* data, size_t size) {
+    while (size > 0) {
+        ssize_t const n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+bool SendResponse(int fd, int status, char const* reason, char const* contentType, vector<unsigned char> const* body, bool head, bool keepAlive, char const* extraHeaders = "") {
+    size_t const length = body ? body->size() : strlen(reason);
+    ostringstream ss;
+    ss << "HTTP/1.1 " << status << " " << reason << "\r\n"
+       << "Content-Type: " << (body ? contentType : "text/plain") << "\r\n"
+       << "Content-Length: " << length << "\r\n"
+       << "Cache-Control: no-cache\r\n"
+       << "Connection: " << (keepAlive ? "keep-alive" : "close") << "\r\n"
+       << extraHeaders
+       << "\r\n";
+    string const header = ss.str();
+    if (!SendAll(fd, header.data(), header.size())) {
+        return false;
+    }
+    if (head) {
+        return true;
+    }
+    if (body) {
+        return SendAll(fd, (char const*)body->data(), body->size());
+    }
+    return SendAll(fd, reason, length);
+}
+
+string ToLower(string s) {
+    for (char& c : s) {
+        c = (char)tolower((unsigned char)c);
+    }
+    return s;
+}
+
+// "/r.X.Z.png" の形だけを受け付ける. クエリ文字列は無視する.
+bool ParseTilePath(string path, int& regionX, int& regionZ) {
+    if (auto q = path.find('?'); q != string::npos) {
+        path.resize(q);
+    }
+    int consumed = 0;
+    if (sscanf(path.c_str(), "/r.%d.%d.png%n", &regionX, &regionZ, &consumed) != 2) {
+        return false;
+    }
+    return consumed == (int)path.size();
+}
+
+} // namespace
+
+TileServer::TileServer(Render render, uint64_t cacheBytes)
+    : fRender(move(render))
+    , fCapacity(cacheBytes)
+{
+}
+
+TileServer::~TileServer() {
+    {
+        unique_lock<mutex> lock(fMutex);
+        for (int fd : fConnections) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        fConnectionsClosed.wait(lock, [this]() { return fConnections.empty(); });
+    }
+    if (fListenFd >= 0) {
+        close(fListenFd);
+    }
+    if (fSpareFd >= 0) {
+        close(fSpareFd);
+    }
+}
+
+bool TileServer::listen(uint16_t port, string& error) {
+    int const fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error = strerror(errno);
+        return false;
+    }
+    int const yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::bind(fd, (sockaddr const*)&addr, sizeof(addr)) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+        error = strerror(errno);
+        close(fd);
+        return false;
+    }
+    fListenFd = fd;
+    fSpareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return true;
+}
+
+bool TileServer::run() {
+    while (true) {
+        int const fd = accept4(fListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fStopping) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return true;
+        }
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                dropPendingConnection(errno);
+                continue;
+            }
+            return false;
+        }
+        // 使われないままの keep-alive 接続は時間切れで閉じる.
+        timeval timeout{};
+        timeout.tv_sec = kIdleTimeoutSeconds;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        {
+            lock_guard<mutex> lock(fMutex);
+            fConnections.insert(fd);
+        }
+        thread([this, fd]() {
+            serve(fd);
+            lock_guard<mutex> lock(fMutex);
+            close(fd);
+            fConnections.erase(fd);
+            if (fConnections.empty()) {
+                fConnectionsClosed.notify_all();
+            }
+        }).detach();
+    }
+}
+
+// 待ち受けている socket を shutdown すると, 止まっている accept が失敗して戻る.
+void TileServer::stop() {
+    fStopping = true;
+    shutdown(fListenFd, SHUT_RDWR);
+}
+
+// fd を使い切ると, 待っている接続を受け取れないまま accept が即座に失敗し続ける.
+// 予備の fd を空けてその接続を受け取って閉じ, 予備も無ければ少し待つ.
+void TileServer::dropPendingConnection(int error) {
+    cerr << "tile server: accept: " << strerror(error) << "; dropping a connection" << endl;
+    if (fSpareFd >= 0) {
+        close(fSpareFd);
+        fSpareFd = -1;
+        if (int const fd = accept4(fListenFd, nullptr, nullptr, SOCK_CLOEXEC); fd >= 0) {
+            close(fd);
+        }
+        fSpareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    } else {
+        this_thread::sleep_for(chrono::milliseconds(kAcceptBackoffMilliseconds));
+    }
+}
+
+void TileServer::serve(int fd) {
+    string buffer;
+    char chunk[4096];
+    while (true) {
+        size_t end;
+        while ((end = buffer.find("\r\n\r\n")) == string::npos) {
+            if (buffer.size() > kMaxHeaderBytes) {
+                SendResponse(fd, 431, "Request Header Fields Too Large", nullptr, nullptr, false, false);
+                return;
+            }
+            ssize_t const n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return;
+            }
+            buffer.append(chunk, (size_t)n);
+        }
+        istringstream request(buffer.substr(0, end + 2));
+        // ボディ付きのリクエストは受け付けないので, 次のリクエストはヘッダーの直後から始まる.
+        buffer.erase(0, end + 4);
+
+        string line;
+        getline(request, line);
+        string method, path, version;
+        istringstream(line) >> method >> path >> version;
+        bool keepAlive = version == "HTTP/1.1";
+        bool hasBody = false;
+        while (getline(request, line)) {
+            auto colon = line.find(':');
+            if (colon == string::npos) {
+                continue;
+            }
+            string const name = ToLower(line.substr(0, colon));
+            string value = ToLower(line.substr(colon + 1));
+            value.erase(0, value.find_first_not_of(" \t"));
+            value.erase(value.find_last_not_of(" \t\r") + 1);
+            if (name == "connection") {
+                if (value == "close") {
+                    keepAlive = false;
+                } else if (value == "keep-alive") {
+                    keepAlive = true;
+                }
+            } else if ((name == "content-length" && value != "0") || name == "transfer-encoding") {
+                hasBody = true;
+            }
+        }
+
+        if (version.rfind("HTTP/1.", 0) != 0 || hasBody) {
+            SendResponse(fd, 400, "Bad Request", nullptr, nullptr, false, false);
+            return;
+        }
+        bool const head = method == "HEAD";
+        if (method != "GET" && !head) {
+            if (!SendResponse(fd, 405, "Method Not Allowed", nullptr, nullptr, false, keepAlive, "Allow: GET, HEAD\r\n") || !keepAlive) {
+                return;
+            }
+            continue;
+        }
+        int regionX, regionZ;
+        Tile found;
+        if (ParseTilePath(path, regionX, regionZ)) {
+            found = tile(regionX, regionZ);
+        }
+        bool const sent = found
+            ? SendResponse(fd, 200, "OK", "image/png", found.get(), head, keepAlive)
+            : SendResponse(fd, 404, "Not Found", nullptr, nullptr, head, keepAlive);
+        if (!sent || !keepAlive) {
+            return;
+        }
+    }
+}
+
+TileServer::Tile TileServer::tile(int regionX, int regionZ) {
+    Key const key(regionX, regionZ);
+    promise<Tile> rendered;
+    uint64_t generation;
+    {
+        unique_lock<mutex> lock(fMutex);
+        if (auto found = fEntries.find(key); found != fEntries.end()) {
+            // 描画中なら, 先に始めたリクエストの結果を待つ.
+            fLru.splice(fLru.begin(), fLru, found->second.fLru);
+            shared_future<Tile> pending = found->second.fTile;
+            lock.unlock();
+            return pending.get();
+        }
+        generation = fNextGeneration++;
+        fLru.push_front(key);
+        fEntries[key] = Entry{rendered.get_future().share(), generation, 0, fLru.begin()};
+    }
+
+    Rendered result;
+    try {
+        result = fRender(regionX, regionZ);
+    } catch (...) {
+        // 待っている他のリクエストは 404 として返す.
+        result = Rendered{nullptr, false};
+    }
+    rendered.set_value(result.tile);
+    if (!result.cacheable) {
+        // 失敗した結果はキャッシュせず, 次のリクエストで描き直す.
+        lock_guard<mutex> lock(fMutex);
+        if (auto found = fEntries.find(key); found != fEntries.end() && found->second.fGeneration == generation) {
+            erase(found);
+        }
+        return result.tile;
+    }
+    completed(key, generation, result.tile);
+    return result.tile;
+}
+
+void TileServer::completed(Key key, uint64_t generation, Tile const& tile) {
+    lock_guard<mutex> lock(fMutex);
+    auto found = fEntries.find(key);
+    if (found == fEntries.end() || found->second.fGeneration != generation) {
+        // 描画中に無効化された
+        return;
+    }
+    found->second.fBytes = kEntryOverhead + (tile ? tile->size() : 0);
+    fBytes += found->second.fBytes;
+    evict();
+}
+
+void TileServer::evict() {
+    // 描画中のもの (fBytes == 0) は容量に数えていないので残しておく.
+    auto it = fLru.end();
+    while (fBytes > fCapacity && it != fLru.begin()) {
+        --it;
+        auto found = fEntries.find(*it);
+        if (found->second.fBytes == 0) {
+            continue;
+        }
+        it = fLru.erase(it);
+        fBytes -= found->second.fBytes;
+        fEntries.erase(found);
+    }
+}
+
+void TileServer::erase(map<Key, Entry>::iterator it) {
+    fBytes -= it->second.fBytes;
+    fLru.erase(it->second.fLru);
+    fEntries.erase(it);
+}
+
+void TileServer::invalidate(int regionX, int regionZ) {
+    lock_guard<mutex> lock(fMutex);
+    if (auto found = fEntries.find(Key(regionX, regionZ)); found != fEntries.end()) {
+        erase(found);
+    }
+}
+
+void TileServer::invalidateAll() {
+    lock_guard<mutex> lock(fMutex);
+    fEntries.clear();
+    fLru.clear();
+    fBytes = 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 127.0.0.1 だけで待ち受ける最小限の HTTP/1.1 サーバー. GET /r.X.Z.png に対してエンコード済みの
+// PNG をメモリ上の LRU から返し, 無ければその場で描画する. 同じタイルへの同時のリクエストは
+// 1 回の描画にまとめる.
+class TileServer {
+public:
+    using Tile = std::shared_ptr<std::vector<unsigned char> const>;
+    struct Rendered {
+        // 描画するものが無いリージョンは nullptr
+        Tile tile;
+        // 読み込みやエンコードの失敗など, やり直せば結果が変わりうる場合は false. キャッシュしない.
+        bool cacheable = true;
+    };
+    // 複数のスレッドから同時に呼ばれる.
+    using Render = std::function<Rendered(int regionX, int regionZ)>;
+
+    TileServer(Render render, uint64_t cacheBytes);
+    // 応答中の接続を閉じ, それぞれのスレッドが終わるのを待つ.
+    ~TileServer();
+
+    TileServer(TileServer const&) = delete;
+    TileServer& operator=(TileServer const&) = delete;
+
+    bool listen(uint16_t port, std::string& error);
+    // 接続毎にスレッドを立てて応答する. stop() で止めた場合は true, 待ち受けに失敗した場合は false を返す.
+    bool run();
+    // run() を戻す. シグナルハンドラからも呼べる.
+    void stop();
+
+    // キャッシュから取り出すか, 描画して返す.
+    Tile tile(int regionX, int regionZ);
+
+    // 描画中のものは, 終わってもキャッシュに入れない.
+    void invalidate(int regionX, int regionZ);
+    void invalidateAll();
+
+private:
+    using Key = std::pair<int, int>;
+
+    struct Entry {
+        std::shared_future<Tile> fTile;
+        uint64_t fGeneration;
+        // 描画が終わるまでは 0
+        uint64_t fBytes;
+        std::list<Key>::iterator fLru;
+    };
+
+    // fd が足りずに accept できない時に, 待っている接続を 1 つ閉じる.
+    void dropPendingConnection(int error);
+    void serve(int fd);
+    void completed(Key key, uint64_t generation, Tile const& tile);
+    void evict();
+    void erase(std::map<Key, Entry>::iterator it);
+
+private:
+    Render const fRender;
+    uint64_t const fCapacity;
+    int fListenFd = -1;
+    // fd を使い切った時に空けるための予備
+    int fSpareFd = -1;
+    std::atomic_bool fStopping = false;
+
+    // 応答中の接続. fMutex で守る.
+    std::set<int> fConnections;
+    std::condition_variable fConnectionsClosed;
+
+    std::mutex fMutex;
+    std::map<Key, Entry> fEntries;
+    // 先頭が最近使ったもの
+    std::list<Key> fLru;
+    uint64_t fBytes = 0;
+    uint64_t fNextGeneration = 0;
+};
@@ -0,0 +1,93 @@
+#include "world_index.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+shared_ptr<WorldIndex> WorldIndex::Build(fs::path const& world) {
+    fs::path const dir = world / "chunk";
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return nullptr;
+    }
+    int const fd = dirfd(d);
+    auto index = make_shared<WorldIndex>();
+    index->fDirectory = dir;
+    while (dirent* entry = readdir(d)) {
+        int chunkX;
+        int chunkZ;
+        int length = 0;
+        if (sscanf(entry->d_name, "c.%d.%d.nbt.z%n", &chunkX, &chunkZ, &length) != 2 || entry->d_name[length] != '\0') {
+            continue;
+        }
+        struct stat st;
+        if (fstatat(fd, entry->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        RegionIndex& region = index->fRegions[make_pair(chunkX >> 5, chunkZ >> 5)];
+        int const i = RegionIndex::Index(chunkX & 31, chunkZ & 31);
+        region.fPresent.set(i);
+        region.fSizes[i] = (uint32_t)st.st_size;
+        region.fModified[i] = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+    closedir(d);
+    return index;
+}
+
+RegionIndex const* WorldIndex::region(int regionX, int regionZ) const {
+    auto found = fRegions.find(make_pair(regionX, regionZ));
+    if (found == fRegions.end()) {
+        return nullptr;
+    }
+    return &found->second;
+}
+
+bool WorldIndex::hasChunk(int chunkX, int chunkZ) const {
+    RegionIndex const* r = region(chunkX >> 5, chunkZ >> 5);
+    return r && r->has(chunkX & 31, chunkZ & 31);
+}
+
+vector<pair<int, int>> WorldIndex::regions() const {
+    vector<pair<int, int>> ret;
+    ret.reserve(fRegions.size());
+    for (auto const& it : fRegions) {
+        ret.push_back(it.first);
+    }
+    return ret;
+}
+
+bool WorldIndex::refresh(int chunkX, int chunkZ) {
+    char name[64];
+    snprintf(name, sizeof(name), "c.%d.%d.nbt.z", chunkX, chunkZ);
+    fs::path const file = fDirectory / name;
+    auto const key = make_pair(chunkX >> 5, chunkZ >> 5);
+    int const i = RegionIndex::Index(chunkX & 31, chunkZ & 31);
+    struct stat st;
+    if (stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        auto found = fRegions.find(key);
+        if (found == fRegions.end() || !found->second.fPresent[i]) {
+            return false;
+        }
+        found->second.fPresent.reset(i);
+        found->second.fSizes[i] = 0;
+        found->second.fModified[i] = 0;
+        if (found->second.chunks() == 0) {
+            fRegions.erase(found);
+        }
+        return true;
+    }
+    uint32_t const size = (uint32_t)st.st_size;
+    int64_t const modified = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    RegionIndex& region = fRegions[key];
+    if (region.fPresent[i] && region.fSizes[i] == size && region.fModified[i] == modified) {
+        return false;
+    }
+    region.fPresent.set(i);
+    region.fSizes[i] = size;
+    region.fModified[i] = modified;
+    return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+struct RegionIndex {
+    static int Index(int localChunkX, int localChunkZ) {
+        return localChunkZ * 32 + localChunkX;
+    }
+
+    bool has(int localChunkX, int localChunkZ) const {
+        return fPresent[Index(localChunkX, localChunkZ)];
+    }
+
+    int chunks() const {
+        return (int)fPresent.count();
+    }
+
+    std::bitset<32 * 32> fPresent;
+    std::array<uint32_t, 32 * 32> fSizes{};
+    // エポックからのナノ秒
+    std::array<int64_t, 32 * 32> fModified{};
+};
+
+// world/chunk を一度だけ走査して, 存在するチャンクファイルの一覧をリージョン毎に保持する.
+class WorldIndex {
+public:
+    static std::shared_ptr<WorldIndex> Build(std::filesystem::path const& world);
+
+    RegionIndex const* region(int regionX, int regionZ) const;
+    bool hasChunk(int chunkX, int chunkZ) const;
+    std::vector<std::pair<int, int>> regions() const;
+
+    // チャンクファイルの状態を読み直して反映する. ファイルが消えていれば一覧から外し,
+    // チャンクが 1 つも無くなったリージョンも外す. 大きさと更新時刻が前回と同じなら false.
+    bool refresh(int chunkX, int chunkZ);
+
+private:
+    std::filesystem::path fDirectory;
+    std::map<std::pair<int, int>, RegionIndex> fRegions;
+};
@@ -0,0 +1,39 @@
+// kBlockInfo は無名名前空間にあるので, 翻訳単位ごと取り込んで直接比べる.
+#include "block_color.cpp"
+
+#include "block_color_reference.inc"
+#include "test.h"
+
+using namespace std;
+namespace blocks = mcfile::blocks;
+
+static bool SameColor(Color const& a, Color const& b) {
+    return a.fR == b.fR && a.fG == b.fG && a.fB == b.fB && a.fA == b.fA;
+}
+
+int main() {
+    int mismatches = 0;
+    for (blocks::BlockId id = 0; id < blocks::minecraft::minecraft_max_block_id; id++) {
+        auto const& info = kBlockInfo[id];
+
+        auto expected = reference::blockToColor.find(id);
+        bool const hasColor = (info.fFlags & kHasColor) != 0;
+        bool ok = hasColor == (expected != reference::blockToColor.end());
+        if (ok && hasColor) {
+            ok = SameColor(info.fColor, expected->second);
+        }
+        ok = ok && IsPlantBlock(id) == (reference::sPlantBlocks.count(id) > 0);
+        ok = ok && IsTransparentBlock(id) == (reference::sTransparentBlocks.count(id) > 0);
+        if (!ok) {
+            cerr << "BlockId " << id << " differs from the reference tables" << endl;
+            mismatches++;
+        }
+    }
+    CHECK(mismatches == 0);
+
+    // 表の外の番号は色もフラグも持たない.
+    CHECK(!IsPlantBlock(blocks::minecraft::minecraft_max_block_id));
+    CHECK(!IsTransparentBlock(blocks::minecraft::minecraft_max_block_id));
+
+    return TestResult();
+}
@@ -0,0 +1,88 @@
+#include "block_states.h"
+#include "nbt_writer.h"
+#include "test.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace mcfile;
+
+namespace {
+
+// 下端 (Y=-5) と上端 (Y=20) に, ワールドで実際に見られる光源の情報だけのセクションを置く.
+shared_ptr<nbt::CompoundTag> MakeChunkWithLightOnlySections() {
+    NbtWriter w;
+    w.beginCompound("");
+    w.intTag("DataVersion", 3465);
+    w.stringTag("Status", "minecraft:full");
+    w.beginList("sections", NbtWriter::kCompound, 4);
+
+    w.beginElement();
+    w.byteTag("Y", -5);
+    w.endCompound();
+
+    UniformSection(w, -4, "minecraft:stone");
+
+    // 2 種類のブロック. 下半分が dirt, 上半分が air.
+    w.beginElement();
+    w.byteTag("Y", -3);
+    w.beginCompound("block_states");
+    w.beginList("palette", NbtWriter::kCompound, 2);
+    w.stringTag("Name", "minecraft:dirt");
+    w.endCompound();
+    w.stringTag("Name", "minecraft:air");
+    w.endCompound();
+    {
+        // 4bit 毎に 16 エントリで long 1 つ. y < 8 が 0, y >= 8 が 1.
+        vector<int64_t> data(256, 0);
+        for (size_t i = 128; i < 256; i++) {
+            data[i] = (int64_t)0x1111111111111111LL;
+        }
+        w.longArrayTag("data", data);
+    }
+    w.endCompound();
+    w.endCompound();
+
+    w.beginElement();
+    w.byteTag("Y", 20);
+    w.endCompound();
+
+    w.endCompound();
+    return nbt::CompoundTag::Read(w.data(), Endian::Big);
+}
+
+} // namespace
+
+int main() {
+    auto root = MakeChunkWithLightOnlySections();
+    CHECK(root);
+    if (!root) {
+        return TestResult();
+    }
+    auto blocks = ChunkBlocks::Make(2, -1, *root);
+    CHECK(blocks);
+    if (!blocks) {
+        return TestResult();
+    }
+
+    // block_states の無いセクションは範囲に含めない.
+    CHECK(blocks->minBlockY() == -64);
+    CHECK(blocks->maxBlockY() == -33);
+    CHECK(blocks->minBlockX() == 32);
+    CHECK(blocks->minBlockZ() == -16);
+
+    CHECK(blocks->blockIdAt(32, -64, -16) == blocks::minecraft::stone);
+    CHECK(blocks->blockIdAt(47, -49, -1) == blocks::minecraft::stone);
+    CHECK(blocks->blockIdAt(40, -48, -8) == blocks::minecraft::dirt);
+    CHECK(blocks->blockIdAt(40, -41, -8) == blocks::minecraft::dirt);
+    CHECK(blocks->blockIdAt(40, -40, -8) == blocks::minecraft::air);
+    CHECK(blocks->blockIdAt(40, -33, -8) == blocks::minecraft::air);
+
+    // 光源だけのセクションの位置にはブロックが無い.
+    CHECK(!blocks->blockAt(40, -80, -8));
+    CHECK(!blocks->blockAt(40, 320, -8));
+
+    return TestResult();
+}
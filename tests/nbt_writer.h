@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// テスト用のチャンクを組み立てるための, ビッグエンディアンの NBT の最小限の書き出し.
+class NbtWriter {
+public:
+    enum Type : uint8_t {
+        kEnd = 0,
+        kByte = 1,
+        kInt = 3,
+        kString = 8,
+        kList = 9,
+        kCompound = 10,
+        kLongArray = 12,
+    };
+
+    void beginCompound(std::string const& name) {
+        header(kCompound, name);
+    }
+
+    void endCompound() {
+        fOut.push_back(kEnd);
+    }
+
+    void beginList(std::string const& name, Type type, int32_t count) {
+        header(kList, name);
+        fOut.push_back(type);
+        int32(count);
+    }
+
+    void byteTag(std::string const& name, int8_t value) {
+        header(kByte, name);
+        fOut.push_back((uint8_t)value);
+    }
+
+    void intTag(std::string const& name, int32_t value) {
+        header(kInt, name);
+        int32(value);
+    }
+
+    void stringTag(std::string const& name, std::string const& value) {
+        header(kString, name);
+        str(value);
+    }
+
+    void longArrayTag(std::string const& name, std::vector<int64_t> const& values) {
+        header(kLongArray, name);
+        int32((int32_t)values.size());
+        for (int64_t v : values) {
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                fOut.push_back((uint8_t)((uint64_t)v >> shift));
+            }
+        }
+    }
+
+    // リストの要素の compound. 名前は付かない.
+    void beginElement() {
+    }
+
+    std::vector<uint8_t>& data() {
+        return fOut;
+    }
+
+private:
+    void header(Type type, std::string const& name) {
+        fOut.push_back(type);
+        str(name);
+    }
+
+    void str(std::string const& s) {
+        fOut.push_back((uint8_t)(s.size() >> 8));
+        fOut.push_back((uint8_t)(s.size() & 0xff));
+        fOut.insert(fOut.end(), s.begin(), s.end());
+    }
+
+    void int32(int32_t v) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            fOut.push_back((uint8_t)((uint32_t)v >> shift));
+        }
+    }
+
+private:
+    std::vector<uint8_t> fOut;
+};
+
+// 1 種類のブロックだけで埋まったセクション.
+inline void UniformSection(NbtWriter& w, int8_t y, std::string const& block) {
+    w.beginElement();
+    w.byteTag("Y", y);
+    w.beginCompound("block_states");
+    w.beginList("palette", NbtWriter::kCompound, 1);
+    w.stringTag("Name", block);
+    w.endCompound();
+    w.endCompound();
+    w.endCompound();
+}
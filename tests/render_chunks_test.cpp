@@ -0,0 +1,112 @@
+#include "mca2png.h"
+#include "chunk_io.h"
+#include "nbt_writer.h"
+#include "test.h"
+
+#include <unistd.h>
+#include <zlib.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+// 下端のセクションだけが stone のチャンクを zlib で圧縮したもの. c.X.Z.nbt.z の中身と同じ形式.
+vector<uint8_t> StoneChunk() {
+    NbtWriter w;
+    w.beginCompound("");
+    w.intTag("DataVersion", 3465);
+    w.stringTag("Status", "minecraft:full");
+    w.beginList("sections", NbtWriter::kCompound, 1);
+    UniformSection(w, -4, "minecraft:stone");
+    w.endCompound();
+    vector<uint8_t> const& nbt = w.data();
+    uLongf size = compressBound(nbt.size());
+    vector<uint8_t> out(size);
+    if (compress2(out.data(), &size, nbt.data(), nbt.size(), Z_BEST_SPEED) != Z_OK) {
+        return vector<uint8_t>();
+    }
+    out.resize(size);
+    return out;
+}
+
+ChunkBuffer Buffer(int chunkX, int chunkZ) {
+    return ChunkBuffer{chunkX, chunkZ, StoneChunk()};
+}
+
+// 空の chunk ディレクトリだけのワールド. チャンクは呼び出し側から渡す.
+class TemporaryWorld {
+public:
+    TemporaryWorld()
+        : fDirectory(fs::temp_directory_path() / ("mca2png_test." + to_string(getpid())))
+    {
+        fs::create_directories(fDirectory / "chunk");
+    }
+
+    ~TemporaryWorld() {
+        error_code ec;
+        fs::remove_all(fDirectory, ec);
+    }
+
+    fs::path const& directory() const {
+        return fDirectory;
+    }
+
+private:
+    fs::path const fDirectory;
+};
+
+// リージョンの外 (北西の角と, 遠く離れた場所) のチャンクと, 同じ座標のチャンクが混ざっていても
+// 範囲外に書いたり, タイルを待ち続けたりしないこと.
+void TestRenderRegionIgnoresStrayChunks(mca2png::World& world) {
+    vector<ChunkBuffer> chunks;
+    chunks.push_back(Buffer(0, 0));
+    chunks.push_back(Buffer(0, 0));
+    chunks.push_back(Buffer(1, 0));
+    chunks.push_back(Buffer(-1, -1));
+    chunks.push_back(Buffer(40, 3));
+    chunks.push_back(Buffer(3, -5));
+    chunks.push_back(Buffer(-100, 7));
+    vector<uint32_t> rgba(mca2png::kRegionSize * mca2png::kRegionSize, 0);
+    vector<int16_t> altitude(rgba.size(), 0);
+    CHECK(world.renderRegion(mca2png::kOverworld, 0, 0, move(chunks), rgba.data(), altitude.data()));
+    CHECK(rgba[0] != 0);
+    CHECK(rgba[31] != 0);
+    CHECK(rgba[32] == 0);
+    CHECK(altitude[0] == -49);
+}
+
+void TestRenderAreaIgnoresStrayChunks(mca2png::World& world) {
+    vector<ChunkBuffer> chunks;
+    chunks.push_back(Buffer(0, 0));
+    chunks.push_back(Buffer(0, 0));
+    chunks.push_back(Buffer(-1, 0));
+    chunks.push_back(Buffer(5, 5));
+    chunks.push_back(Buffer(-40, -40));
+    int const size = 16;
+    vector<uint32_t> rgba(size * size, 0);
+    vector<int16_t> altitude(rgba.size(), 0);
+    CHECK(world.renderArea(mca2png::kOverworld, 0, 0, size - 1, size - 1, move(chunks), rgba.data(), altitude.data()));
+    CHECK(rgba[0] != 0);
+    CHECK(rgba[size * size - 1] != 0);
+    CHECK(altitude[0] == -49);
+}
+
+} // namespace
+
+int main() {
+    TemporaryWorld directory;
+    auto world = mca2png::World::Open(directory.directory(), mca2png::kOverworld, mca2png::World::Options());
+    CHECK(world);
+    if (!world) {
+        return TestResult();
+    }
+    TestRenderRegionIgnoresStrayChunks(*world);
+    TestRenderAreaIgnoresStrayChunks(*world);
+    return TestResult();
+}
@@ -0,0 +1,164 @@
+#include "rgba8.h"
+#include "test.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// 8bit 版は途中で毎回丸めるので, float の Color から求めた値と最大 1 LSB ずれてよい.
+int const kTolerance = 1;
+
+struct Sample {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+};
+
+// 各成分の端と, 丸めの境界に近い値を混ぜたもの.
+Sample const kSamples[] = {
+    {0, 0, 0, 0},
+    {255, 255, 255, 255},
+    {0, 0, 0, 255},
+    {255, 255, 255, 0},
+    {69, 91, 211, 255},
+    {69, 91, 211, 38},
+    {111, 111, 111, 255},
+    {1, 2, 254, 1},
+    {17, 128, 200, 64},
+    {127, 128, 129, 127},
+    {128, 127, 126, 128},
+    {200, 17, 64, 200},
+    {254, 1, 2, 254},
+    {255, 0, 128, 51},
+    {75, 125, 151, 179},
+    {33, 17, 20, 230},
+};
+
+float const kFactors[] = {0.f, 0.5f, 0.8f, 0.9f, 1.f, 1.1f, 1.2f, 1.5f, 2.f, 3.f};
+
+Color ToColor(Sample s) {
+    return Color(s.r, s.g, s.b, s.a);
+}
+
+Rgba8 ToRgba8(Sample s) {
+    return Rgba8::Make(s.r, s.g, s.b, s.a);
+}
+
+// 0..1 の float を 8bit に丸める. 範囲外は飽和させる.
+int Quantize(float v) {
+    if (v <= 0) {
+        return 0;
+    }
+    if (1 <= v) {
+        return 255;
+    }
+    return (int)lrintf(v * 255);
+}
+
+bool Near(int actual, int expected) {
+    return abs(actual - expected) <= kTolerance;
+}
+
+// 乗算済みアルファで比べる.
+bool NearPremultiplied(Rgba8 actual, Color expected) {
+    return Near(actual.fR, Quantize(expected.fR * expected.fA))
+        && Near(actual.fG, Quantize(expected.fG * expected.fA))
+        && Near(actual.fB, Quantize(expected.fB * expected.fA))
+        && Near(actual.fA, Quantize(expected.fA));
+}
+
+void TestBlend() {
+    for (auto const& fg : kSamples) {
+        for (auto const& bg : kSamples) {
+            Color const expected = Color::Blend(ToColor(fg), ToColor(bg));
+            Rgba8 const actual = Rgba8::Blend(ToRgba8(fg), ToRgba8(bg));
+            CHECK(NearPremultiplied(actual, expected));
+        }
+    }
+}
+
+void TestAdd() {
+    for (auto const& a : kSamples) {
+        for (auto const& b : kSamples) {
+            Color const expected = Color::Add(ToColor(a), ToColor(b));
+            Rgba8 const actual = Rgba8::Add(ToRgba8(a), ToRgba8(b));
+            CHECK(Near(actual.fR, Quantize(expected.fR)));
+            CHECK(Near(actual.fG, Quantize(expected.fG)));
+            CHECK(Near(actual.fB, Quantize(expected.fB)));
+            CHECK(actual.fA == 255);
+        }
+    }
+}
+
+// HSV の V を定数倍して RGB に戻したものと比べる.
+void TestBrightnessTable() {
+    for (float factor : kFactors) {
+        BrightnessTable const table(factor);
+        for (auto const& s : kSamples) {
+            HSV hsv = Color(s.r, s.g, s.b).toHSV();
+            hsv.fV *= factor;
+            Color const expected = Color::FromHSV(hsv);
+            CHECK(Near(table[s.r], Quantize(expected.fR)));
+            CHECK(Near(table[s.g], Quantize(expected.fG)));
+            CHECK(Near(table[s.b], Quantize(expected.fB)));
+        }
+        for (int v = 0; v < 256; v++) {
+            HSV hsv = Color(v, v, v).toHSV();
+            hsv.fV *= factor;
+            CHECK(Near(table[v], Quantize(Color::FromHSV(hsv).fR)));
+        }
+    }
+}
+
+// 手前から順に積んだ層を, 奥から 1 層ずつ Blend したものと完全に一致すること.
+void TestTranslucentLayers() {
+    Rgba8 const glass = Rgba8::Make(255, 255, 255, 4);
+    Rgba8 const red = Rgba8::Make(255, 0, 0, 127);
+    Rgba8 const blue = Rgba8::Make(0, 0, 255, 127);
+    Rgba8 const black = Rgba8::Make(0, 0, 0, 127);
+    // アルファは 2 層で 255 に達するが, 丸めのせいで奥の色が 1 LSB 透ける.
+    Rgba8 const leaky = Rgba8{127, 127, 127, 254};
+    vector<Rgba8> saturating(40, red);
+    saturating.insert(saturating.end(), {blue, glass, black, blue, red});
+    vector<Rgba8> leakyThenOther = {leaky, leaky, leaky, blue, glass, blue};
+    vector<vector<Rgba8>> const stacks = {
+        {},
+        {glass},
+        {red, red, red},
+        {red, blue},
+        {glass, red, glass, blue, glass, black, red, red, blue},
+        vector<Rgba8>(300, glass),
+        vector<Rgba8>(300, black),
+        saturating,
+        leakyThenOther,
+        {Rgba8::Make(10, 20, 30, 255), red, blue},
+    };
+    for (auto const& stack : stacks) {
+        TranslucentLayers layers;
+        for (Rgba8 c : stack) {
+            layers.add(c);
+        }
+        for (auto const& s : kSamples) {
+            Rgba8 expected = ToRgba8(s);
+            for (size_t i = stack.size(); i > 0; i--) {
+                expected = Rgba8::Blend(stack[i - 1], expected);
+            }
+            CHECK(layers.over(ToRgba8(s)) == expected);
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    TestBlend();
+    TestAdd();
+    TestBrightnessTable();
+    TestTranslucentLayers();
+    return TestResult();
+}
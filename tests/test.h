@@ -0,0 +1,25 @@
+#pragma once
+
+#include <iostream>
+
+// 外部のテストフレームワークには頼らない. 失敗した CHECK の数を終了コードにする.
+inline int& TestFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+            TestFailures()++;                                                    \
+        }                                                                        \
+    } while (false)
+
+inline int TestResult() {
+    if (TestFailures() > 0) {
+        std::cerr << TestFailures() << " check(s) failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
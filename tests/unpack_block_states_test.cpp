@@ -0,0 +1,95 @@
+// UnpackScalar と UnpackAvx2 は static なので, 翻訳単位ごと取り込んで直接比べる.
+#include "block_states.cpp"
+
+#include "test.h"
+
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// エントリが long をまたがない形式で詰める.
+vector<int64_t> Pack(vector<uint16_t> const& indices, int bits) {
+    int const perLong = 64 / bits;
+    vector<int64_t> data((indices.size() + perLong - 1) / perLong, 0);
+    for (size_t i = 0; i < indices.size(); i++) {
+        uint64_t const v = (uint64_t)indices[i] << ((i % perLong) * bits);
+        data[i / perLong] = (int64_t)((uint64_t)data[i / perLong] | v);
+    }
+    return data;
+}
+
+bool Same(vector<uint16_t> const& expected, vector<uint16_t> const& actual, int bits, char const* name) {
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (expected[i] != actual[i]) {
+            cerr << name << ": bits=" << bits << " differs at " << i << ": expected " << expected[i] << ", actual " << actual[i] << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+#if defined(MCA2PNG_UNPACK_AVX2)
+template<int Bits>
+void UnpackAvx2Bits(int bits, int64_t const* data, uint16_t* out) {
+    if constexpr (Bits <= 12) {
+        if (bits == Bits) {
+            UnpackAvx2<Bits>(data, out);
+        } else {
+            UnpackAvx2Bits<Bits + 1>(bits, data, out);
+        }
+    }
+}
+#endif
+
+void TestWidth(int bits, mt19937& rng) {
+    uniform_int_distribution<int> dist(0, (1 << bits) - 1);
+    vector<uint16_t> expected(4096);
+    for (auto& v : expected) {
+        v = (uint16_t)dist(rng);
+    }
+    // 最大値を必ず含める
+    expected[4095] = (uint16_t)((1 << bits) - 1);
+    vector<int64_t> const data = Pack(expected, bits);
+
+    vector<uint16_t> scalar(4096, 0xffff);
+    UnpackScalar(data.data(), bits, 0, scalar.data());
+    CHECK(Same(expected, scalar, bits, "UnpackScalar"));
+
+#if defined(MCA2PNG_UNPACK_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        vector<uint16_t> avx2(4096, 0xffff);
+        UnpackAvx2Bits<4>(bits, data.data(), avx2.data());
+        CHECK(Same(scalar, avx2, bits, "UnpackAvx2"));
+    }
+#endif
+
+    // パレットの大きさから bits が決まる経路でも同じ結果になること.
+    size_t const paletteSize = bits == 4 ? 16 : ((size_t)1 << (bits - 1)) + 1;
+    for (auto& v : expected) {
+        v = (uint16_t)(v % paletteSize);
+    }
+    vector<int64_t> const packed = Pack(expected, bits);
+    vector<uint16_t> out(4096, 0xffff);
+    CHECK(UnpackBlockStates(packed, paletteSize, out.data()));
+    CHECK(Same(expected, out, bits, "UnpackBlockStates"));
+}
+
+} // namespace
+
+int main() {
+    mt19937 rng(20231);
+    for (int bits = 4; bits <= 12; bits++) {
+        TestWidth(bits, rng);
+    }
+#if defined(MCA2PNG_UNPACK_AVX2)
+    if (!__builtin_cpu_supports("avx2")) {
+        cerr << "avx2 is not supported on this cpu; only the scalar path was checked" << endl;
+    }
+#endif
+    return TestResult();
+}